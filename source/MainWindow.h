@@ -18,6 +18,8 @@ class MainWindow : public QMainWindow {
   MainWindow(QWidget* parent = nullptr);
   ~MainWindow();
 
+  QWGPUWidget* gpuWidget() const noexcept { return gpuWidget_; }
+
  public slots:
   void init();
 
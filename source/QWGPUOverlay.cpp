@@ -0,0 +1,116 @@
+#include "QWGPUOverlay.h"
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+#include "wgpu_error_scope.hpp"
+#include "wgpu_pipelines.hpp"
+
+// Past this many rectangles, upload the bounding rect instead. Each rect is a separate WriteTexture call.
+static constexpr int max_dirty_rects = 16;
+
+void QWGPUOverlay::resize(const int width, const int height) {
+  if (image_.width() == width && image_.height() == height) {
+    return;
+  }
+  QImage resized(std::max(width, 1), std::max(height, 1), QImage::Format_RGBA8888_Premultiplied);
+  resized.fill(Qt::transparent);
+  // Keep what was painted, anchored at the top-left. Content past the new edges is cropped.
+  if (!image_.isNull()) {
+    QPainter painter{&resized};
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0, 0, image_);
+  }
+  image_ = std::move(resized);
+  dirty_ = QRegion(image_.rect());
+}
+
+void QWGPUOverlay::clear(const QRect& rect) {
+  paint(rect, [](QPainter&) {});
+}
+
+void QWGPUOverlay::markDirty(const QRect& rect) {
+  dirty_ += rect.intersected(image_.rect());
+  has_content_ = true;
+}
+
+void QWGPUOverlay::upload(const wgpu::Device& device, const wgpu::Queue& queue) {
+  if (image_.isNull()) {
+    return;
+  }
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  const auto width = static_cast<std::uint32_t>(image_.width());
+  const auto height = static_cast<std::uint32_t>(image_.height());
+  if (!texture_ || texture_.GetWidth() != width || texture_.GetHeight() != height) {
+    wgpu::TextureDescriptor texture_descriptor{};
+    texture_descriptor.label = "Overlay texture";
+    texture_descriptor.size = wgpu::Extent3D{width, height, 1};
+    texture_descriptor.mipLevelCount = 1;
+    texture_descriptor.sampleCount = 1;
+    texture_descriptor.format = wgpu::TextureFormat::RGBA8Unorm;
+    texture_descriptor.dimension = wgpu::TextureDimension::e2D;
+    texture_descriptor.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+    texture_ = wgpu_utils::create_texture(device, texture_descriptor);
+    bind_group_ = nullptr;
+    dirty_ = QRegion(image_.rect());
+  }
+
+  if (dirty_.isEmpty()) {
+    return;
+  }
+  if (dirty_.rectCount() > max_dirty_rects) {
+    dirty_ = QRegion(dirty_.boundingRect());
+  }
+
+  // Copy each rect straight out of the image: the row pitch is just the image's bytes per line.
+  const auto bytes_per_line = static_cast<std::uint32_t>(image_.bytesPerLine());
+  for (const QRect& rect : dirty_) {
+    wgpu::TexelCopyTextureInfo destination{};
+    destination.texture = texture_;
+    destination.mipLevel = 0;
+    destination.origin = wgpu::Origin3D{static_cast<std::uint32_t>(rect.x()), static_cast<std::uint32_t>(rect.y()), 0};
+    destination.aspect = wgpu::TextureAspect::All;
+
+    wgpu::TexelCopyBufferLayout layout{};
+    layout.offset = 0;
+    layout.bytesPerRow = bytes_per_line;
+    layout.rowsPerImage = static_cast<std::uint32_t>(rect.height());
+
+    const wgpu::Extent3D size{static_cast<std::uint32_t>(rect.width()), static_cast<std::uint32_t>(rect.height()), 1};
+    const uchar* const data = image_.constScanLine(rect.y()) + rect.x() * 4;
+    const std::size_t data_size =
+        static_cast<std::size_t>(rect.height() - 1) * bytes_per_line + static_cast<std::size_t>(rect.width()) * 4;
+    wgpu_utils::write_texture(queue, destination, data, data_size, layout, size);
+  }
+  dirty_ = QRegion();
+}
+
+void QWGPUOverlay::draw(const wgpu::Device& device, const wgpu_utils::traced_bundle_encoder& encoder,
+                        const wgpu::TextureFormat surface_format, const std::uint32_t multisample_count) {
+  if (!has_content_ || !texture_) {
+    return;
+  }
+  if (!pipeline_ || pipeline_format_ != surface_format || pipeline_sample_count_ != multisample_count) {
+    std::tie(pipeline_, bg_layout_) =
+        wgpu_utils::make_overlay_render_pipeline(device, surface_format, multisample_count);
+    pipeline_format_ = surface_format;
+    pipeline_sample_count_ = multisample_count;
+    bind_group_ = nullptr;
+  }
+  if (!bind_group_) {
+    wgpu::BindGroupEntry binding{};
+    binding.binding = 0;
+    binding.textureView = wgpu_utils::create_texture_view(texture_);
+    wgpu::BindGroupDescriptor bind_group_desc{};
+    bind_group_desc.layout = bg_layout_;
+    bind_group_desc.entryCount = 1;
+    bind_group_desc.entries = &binding;
+    bind_group_ = wgpu_utils::create_bind_group(device, bind_group_desc);
+  }
+
+  encoder.set_pipeline(pipeline_);
+  encoder.set_bind_group(0, bind_group_);
+  encoder.draw(3);
+}
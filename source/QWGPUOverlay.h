@@ -0,0 +1,68 @@
+#pragma once
+#include <QImage>
+#include <QPainter>
+#include <QRegion>
+
+#include <cstdint>
+#include <utility>
+
+#include <webgpu/webgpu_cpp.h>
+
+#include "wgpu_capture.hpp"
+
+// A layer of QPainter content (labels, HUD, legends) composited over the wgpu scene.
+//
+// Painting goes into a persistent premultiplied QImage. Painted rectangles are tracked as dirty, and only those
+// regions are uploaded to the overlay texture. The texture is then blended over the main render pass with a
+// premultiplied-alpha blend, so static content costs nothing per frame.
+class QWGPUOverlay {
+ public:
+  // Resize the overlay, keeping the content anchored at the top-left and cropping whatever no longer fits. The whole
+  // image is marked dirty.
+  void resize(int width, int height);
+
+  // Paint into `rect`. The rect is cleared to transparent first, and painting is clipped to it.
+  template <typename F>
+  void paint(const QRect& rect, F&& func) {
+    const QRect clipped = rect.intersected(image_.rect());
+    if (clipped.isEmpty()) {
+      return;
+    }
+    QPainter painter{&image_};
+    painter.setClipRect(clipped);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(clipped, Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    std::forward<F>(func)(painter);
+    markDirty(clipped);
+  }
+
+  // Clear `rect` to transparent.
+  void clear(const QRect& rect);
+
+  // Mark a region as needing upload, for content written to `image()` directly.
+  void markDirty(const QRect& rect);
+
+  QImage& image() noexcept { return image_; }
+
+  // Copy dirty regions into the overlay texture, (re)creating it if the size changed.
+  void upload(const wgpu::Device& device, const wgpu::Queue& queue);
+
+  // Composite the overlay over the current render pass. Does nothing if nothing was ever painted.
+  void draw(const wgpu::Device& device, const wgpu_utils::traced_bundle_encoder& encoder,
+            wgpu::TextureFormat surface_format, std::uint32_t multisample_count);
+
+ private:
+  // Byte order is RGBA on every platform, which maps directly onto `RGBA8Unorm`.
+  QImage image_{};
+  QRegion dirty_{};
+  bool has_content_{false};
+
+  wgpu::Texture texture_{};
+  wgpu::BindGroup bind_group_{};
+
+  wgpu::RenderPipeline pipeline_{};
+  wgpu::BindGroupLayout bg_layout_{};
+  wgpu::TextureFormat pipeline_format_{wgpu::TextureFormat::Undefined};
+  std::uint32_t pipeline_sample_count_{0};
+};
@@ -1,8 +1,18 @@
 #include "QWGPUWidget.h"
 
 #include <QCoreApplication>
+#include <QKeyEvent>
 
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <utility>
+#include <vector>
+
+#include "wgpu_capture.hpp"
 #include "wgpu_error_scope.hpp"
+#include "wgpu_fmt.hpp"
+#include "wgpu_pipelines.hpp"
 #include "wgpu_textures.hpp"
 
 #ifdef _WIN32
@@ -62,12 +72,18 @@ QWGPUWidget::QWGPUWidget(QWidget* parent) : QWidget(parent) {
   setAttribute(Qt::WA_NativeWindow);
   setAttribute(Qt::WA_PaintOnScreen);
   setAttribute(Qt::WA_NoSystemBackground);
+
+  // Without the demo the scene is just a root node, spinning the mesh.
+  setSceneDemoSize(0);
 }
 
 void QWGPUWidget::run() {
   // Trigger rendering at ~60Hz.
   connect(&frame_timer_, &QTimer::timeout, this, &QWGPUWidget::onFrameTimerFired);
   frame_timer_.start(16);
+  completion_timer_.setTimerType(Qt::PreciseTimer);
+  completion_timer_.setInterval(1);
+  connect(&completion_timer_, &QTimer::timeout, this, &QWGPUWidget::onCompletionTimerFired);
   start_time_ = std::chrono::steady_clock::now();
 }
 
@@ -75,6 +91,24 @@ void QWGPUWidget::run() {
 void QWGPUWidget::stop() {
   disconnect(&frame_timer_, &QTimer::timeout, this, &QWGPUWidget::onFrameTimerFired);
   frame_timer_.stop();
+  disconnect(&completion_timer_, &QTimer::timeout, this, &QWGPUWidget::onCompletionTimerFired);
+  completion_timer_.stop();
+  stopCapture();
+
+  const auto input_latency = input_latency_.stats();
+  if (input_latency.frame_count > 0) {
+    fmt::print("Input latency over {} frames (p50 / p95 / p99 ms):\n", input_latency.frame_count);
+    for (const auto& [name, stage] : {std::make_pair("submit", input_latency.to_submit),
+                                      std::make_pair("GPU done", input_latency.to_gpu_done),
+                                      std::make_pair("present", input_latency.to_present)}) {
+      fmt::print("{:>10}: {:.2f} / {:.2f} / {:.2f}\n", name, stage.p50.count() / 1000.0, stage.p95.count() / 1000.0,
+                 stage.p99.count() / 1000.0);
+    }
+  }
+  if (input_latency_.marker_enabled()) {
+    fmt::print("Latency markers: {} of {} read back frames held their own tag\n", input_latency.markers_matched,
+               input_latency.markers_checked);
+  }
 }
 
 // Start a render pass by clearing depth + RGB.
@@ -114,175 +148,347 @@ wgpu::RenderPassEncoder make_render_pass_encoder_with_targets(const wgpu::Comman
   return encoder.BeginRenderPass(&render_pass_descriptor);
 }
 
-static constexpr std::string_view shader_source_code = R"wgsl(
-// WGPU NDC coordinates are +Y goes up, +X goes right.
-const p_normalized: array<vec2f, 4> = array<vec2f, 4>(
-  vec2f(-1.0, -1.0),  // NDC bottom left
-  vec2f( 1.0, -1.0),  // NDC bottom right
-  vec2f( 1.0,  1.0),  // NDC top right
-  vec2f(-1.0,  1.0)   // NDC top left
-);
-
-// WGPU texture coordinates have x-right y-down.
-const uvs: array<vec2f, 4> = array<vec2f, 4>(
-  vec2f(0.0, 1.0),
-  vec2f(1.0, 1.0),
-  vec2f(1.0, 0.0),
-  vec2f(0.0, 0.0)
-);
-
-const colors: array<vec3f, 4> = array<vec3f, 4>(
-  vec3f(1.0, 0.0, 0.0),
-  vec3f(0.0, 1.0, 0.0),
-  vec3f(0.0, 0.0, 1.0),
-  vec3f(1.0, 1.0, 1.0),
-);
-
-const vertex_indices: array<u32, 6> = array<u32, 6>(0, 1, 2, 2, 3, 0);
-
-struct VertexOutput {
-  @builtin(position) position: vec4f,
-  @location(0) uv: vec2f,
-  @location(1) color: vec3f,
-};
-
-@group(0) @binding(0) var<uniform> time: f32;
-
-@vertex
-fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> VertexOutput {
-  let index: u32 = vertex_indices[in_vertex_index];
-
-  // Rotate the quad as time elapses:
-  let angle = 0.2 * time;
-  let p: vec2f = p_normalized[index] * 0.5;
-  let p_rotated = mat2x2f(cos(angle), sin(angle), -sin(angle), cos(angle)) * p;
-
-  var out: VertexOutput;
-  out.position = vec4f(p_rotated, 0.0, 1.0);
-  out.uv = uvs[index];
-  out.color = colors[index];
-  return out;
-}
-
-@fragment
-fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-  return vec4f(in.color, 1.0);
-}
-)wgsl";
-
-// Create a simple pipeline that draws a quad on screen.
-std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_toy_render_pipeline(
-    const wgpu::Device& device, const wgpu::TextureFormat surface_format, const std::uint32_t multisample_count) {
-  WGPU_ERROR_FUNCTION_SCOPE(device);
-
-  // Compile simple shader:
-  wgpu::ShaderModuleDescriptor shader_desc{};
-  wgpu::ShaderSourceWGSL shader_source{};
-  shader_desc.nextInChain = &shader_source;
-  shader_source.code = shader_source_code;
-  const auto shader = device.CreateShaderModule(&shader_desc);
-
-  wgpu::BindGroupLayoutEntry entry{};
-  entry.binding = 0;
-  entry.visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment;
-  entry.buffer.type = wgpu::BufferBindingType::Uniform;
-  entry.buffer.minBindingSize = 16;  // Rounded for alignment.
-
-  wgpu::BindGroupLayoutDescriptor descriptor{};
-  descriptor.entryCount = 1;
-  descriptor.entries = &entry;
-  descriptor.label = "Bind group layout";
-
-  const auto bg_layout = device.CreateBindGroupLayout(&descriptor);
-
-  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
-  pipeline_layout_desc.label = "Pipeline layout";
-  pipeline_layout_desc.bindGroupLayoutCount = 1;
-  pipeline_layout_desc.bindGroupLayouts = &bg_layout;
-  const auto pipeline_layout = device.CreatePipelineLayout(&pipeline_layout_desc);
-
-  wgpu::FragmentState frag_state{};
-  frag_state.module = shader;
-  frag_state.entryPoint = "fs_main";
-
-  wgpu::BlendState blend_state{};
-  blend_state.color.srcFactor = wgpu::BlendFactor::SrcAlpha;
-  blend_state.color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
-  blend_state.color.operation = wgpu::BlendOperation::Add;
-  blend_state.alpha.srcFactor = wgpu::BlendFactor::Zero;
-  blend_state.alpha.dstFactor = wgpu::BlendFactor::One;
-  blend_state.alpha.operation = wgpu::BlendOperation::Add;
-
-  wgpu::ColorTargetState color_target_state{};
-  color_target_state.format = surface_format;
-  color_target_state.blend = &blend_state;
-  color_target_state.writeMask = wgpu::ColorWriteMask::All;
-  frag_state.targetCount = 1;
-  frag_state.targets = &color_target_state;
-
-  wgpu::DepthStencilState depth_state{};
-  depth_state.format = wgpu::TextureFormat::Depth32Float;
-  depth_state.depthWriteEnabled = true;
-  depth_state.depthCompare = wgpu::CompareFunction::Less;
-
-  wgpu::RenderPipelineDescriptor pipeline_descriptor{};
-  pipeline_descriptor.vertex.module = shader;
-  pipeline_descriptor.vertex.entryPoint = "vs_main";
-  pipeline_descriptor.vertex.bufferCount = 0;
-
-  pipeline_descriptor.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
-  pipeline_descriptor.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
-  pipeline_descriptor.primitive.frontFace = wgpu::FrontFace::CCW;
-  pipeline_descriptor.primitive.cullMode = wgpu::CullMode::Back;
-  pipeline_descriptor.fragment = &frag_state;
-  pipeline_descriptor.depthStencil = &depth_state;
-  pipeline_descriptor.multisample.count = multisample_count;
-  pipeline_descriptor.multisample.mask = ~0u;
-  pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
-  pipeline_descriptor.label = "Toy pipeline";
-  pipeline_descriptor.layout = pipeline_layout;
-  const auto pipeline = device.CreateRenderPipeline(&pipeline_descriptor);
-  return std::make_tuple(pipeline, bg_layout);
+// Map a mesh file, upload it, and create a pipeline matching its vertex layout. The current mesh is only replaced
+// once the new one has been uploaded, so a bad file or a failed allocation leaves it on screen.
+void QWGPUWidget::loadMeshResources(const std::uint32_t sample_count) {
+  const auto mesh = wgpu_utils::mesh_file::open(mesh_path_.value());
+  mesh_path_.reset();
+  if (!mesh) {
+    return;
+  }
+  const auto& header = mesh->header();
+  fmt::print("Loading mesh: {} vertices, {} indices, attributes = {:#x}\n", header.vertex_count, header.index_count,
+             header.attributes);
+
+  // Meshes that fit in a heap are sub-allocated. Larger ones get dedicated buffers, split where they exceed the
+  // device's buffer size limit, and are streamed so that dawn never stages the whole thing at once.
+  constexpr std::uint64_t stream_threshold = 64 << 20;
+  const auto start = std::chrono::steady_clock::now();
+  std::optional<wgpu_utils::mesh_buffers> buffers{};
+  if (mesh->vertex_data().size() <= mesh_heap_size && mesh->index_data().size() <= mesh_heap_size) {
+    if (!vertex_heap_) {
+      vertex_heap_.emplace(context_->device(), wgpu_utils::buffer_usage_class::vertex, mesh_heap_size);
+      index_heap_.emplace(context_->device(), wgpu_utils::buffer_usage_class::index, mesh_heap_size);
+    }
+    buffers = wgpu_utils::upload_mesh(context_->device(), *mesh, *vertex_heap_, *index_heap_);
+    const auto stats = vertex_heap_->stats();
+    fmt::print("Vertex heaps: {} x {} MiB, {} allocations, fragmentation = {:.2f}\n", vertex_heap_->heap_count(),
+               mesh_heap_size >> 20, stats.allocation_count, stats.fragmentation());
+  } else {
+    const auto upload_mode = mesh->vertex_data().size() > stream_threshold
+                                 ? wgpu_utils::mesh_upload_mode::streamed
+                                 : wgpu_utils::mesh_upload_mode::mapped_at_creation;
+    buffers = wgpu_utils::upload_mesh(context_->device(), *mesh, upload_mode, stream_threshold);
+    if (buffers) {
+      fmt::print("Mesh split over {} vertex and {} index buffers\n", buffers->vertices.size(),
+                 buffers->indices.size());
+    }
+  }
+  if (!buffers) {
+    qWarning("Keeping the current mesh.");
+    return;
+  }
+  qInfo("Uploaded mesh in %lld ms.", static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                                std::chrono::steady_clock::now() - start)
+                                                                .count()));
+
+  // The previous mesh may still be in use by frames in flight. Its ranges are recycled once those complete.
+  releaseMesh();
+  mesh_ = std::move(*buffers);
+  std::tie(mesh_pipeline_, mesh_bg_layout_) = wgpu_utils::make_mesh_render_pipeline(
+      context_->device(), context_->surface_format().value(), sample_count, header);
+
+  float extent = 0.0f;
+  for (std::size_t i = 0; i < 3; ++i) {
+    mesh_center_[i] = 0.5f * (header.bounds_min[i] + header.bounds_max[i]);
+    extent = std::max(extent, header.bounds_max[i] - header.bounds_min[i]);
+  }
+  mesh_scale_ = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+  wgpu::BufferDescriptor descriptor{};
+  descriptor.size = 32;
+  descriptor.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
+  descriptor.label = "Mesh uniform buffer";
+  mesh_uniform_buffer_ = wgpu_utils::create_buffer(context_->device(), descriptor);
+}
+
+// Return the current mesh's heap ranges, once the frames that may still draw it have completed.
+void QWGPUWidget::releaseMesh() {
+  const std::uint64_t last_used_serial = frame_pacer_.submitted_serial();
+  for (const auto& part : mesh_.vertices) {
+    if (part.range.is_suballocated()) {
+      vertex_heap_->free(part.range, last_used_serial);
+    }
+  }
+  for (const auto& part : mesh_.indices) {
+    if (part.range.is_suballocated()) {
+      index_heap_->free(part.range, last_used_serial);
+    }
+  }
+  mesh_ = {};
+  mesh_pipeline_ = nullptr;
+}
+
+// Rate of the synthetic stream in the plot demo.
+static constexpr double plot_demo_sample_rate = 20000.0;
+
+void QWGPUWidget::createPlotResources(const std::uint32_t sample_count) {
+  const auto& device = context_->device();
+  const auto surface_format = context_->surface_format().value();
+  plot_series_.emplace(device, plot_capacity_);
+  plot_bg_layout_ = wgpu_utils::make_plot_bind_group_layout(device);
+  plot_line_pipeline_ = wgpu_utils::make_plot_render_pipeline(device, plot_bg_layout_, surface_format, sample_count,
+                                                              wgpu::PrimitiveTopology::LineStrip);
+  plot_point_pipeline_ = wgpu_utils::make_plot_render_pipeline(device, plot_bg_layout_, surface_format, sample_count,
+                                                               wgpu::PrimitiveTopology::PointList);
+
+  // The ring buffer never moves, so the bind groups only have to be created once.
+  const auto make_bind_group = [&](const wgpu::Buffer& uniform_buffer) {
+    wgpu::BindGroupEntry entries[2]{};
+    entries[0].binding = 0;
+    entries[0].buffer = plot_series_->ring().buffer();
+    entries[0].size = plot_series_->ring().buffer().GetSize();
+    entries[1].binding = 1;
+    entries[1].buffer = uniform_buffer;
+    entries[1].size = sizeof(wgpu_utils::plot_uniforms);
+    wgpu::BindGroupDescriptor descriptor{};
+    descriptor.layout = plot_bg_layout_;
+    descriptor.entryCount = 2;
+    descriptor.entries = entries;
+    return wgpu_utils::create_bind_group(device, descriptor);
+  };
+
+  wgpu::BufferDescriptor descriptor{};
+  descriptor.size = sizeof(wgpu_utils::plot_uniforms);
+  descriptor.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
+  descriptor.label = "Plot line uniform buffer";
+  plot_line_uniform_buffer_ = wgpu_utils::create_buffer(device, descriptor);
+  descriptor.label = "Plot point uniform buffer";
+  plot_point_uniform_buffer_ = wgpu_utils::create_buffer(device, descriptor);
+  plot_line_bg_ = make_bind_group(plot_line_uniform_buffer_);
+  plot_point_bg_ = make_bind_group(plot_point_uniform_buffer_);
+}
+
+// Generate the samples a 20kHz sensor would have produced since the last frame.
+void QWGPUWidget::updatePlotDemo(const double time_seconds) {
+  const auto samples_due = static_cast<std::uint64_t>(time_seconds * plot_demo_sample_rate);
+  if (samples_due <= plot_demo_samples_generated_) {
+    return;
+  }
+  std::vector<wgpu_utils::plot_sample> samples{};
+  samples.reserve(samples_due - plot_demo_samples_generated_);
+  for (std::uint64_t i = plot_demo_samples_generated_; i < samples_due; ++i) {
+    const double t = static_cast<double>(i) / plot_demo_sample_rate;
+    const double value = 0.6 * std::sin(2.0 * std::numbers::pi * 0.7 * t) +
+                         0.15 * std::sin(2.0 * std::numbers::pi * 23.0 * t) +
+                         0.05 * std::sin(2.0 * std::numbers::pi * 311.0 * t);
+    samples.push_back({t, static_cast<float>(value)});
+  }
+  plot_demo_samples_generated_ = samples_due;
+  appendSamples(samples);
+}
+
+// A fine checkerboard, tiled across the toy quad. Without mips it shimmers and moires as soon as it's minified.
+void QWGPUWidget::createPatternTexture() {
+  constexpr std::uint32_t size = 1024;
+  constexpr std::uint32_t cell_size = 4;
+  std::vector<std::byte> texels(size * size * 4);
+  for (std::uint32_t y = 0; y < size; ++y) {
+    for (std::uint32_t x = 0; x < size; ++x) {
+      const auto value = static_cast<std::byte>(((x / cell_size) + (y / cell_size)) % 2 == 0 ? 255 : 32);
+      std::byte* const texel = &texels[(y * size + x) * 4];
+      texel[0] = texel[1] = texel[2] = value;
+      texel[3] = std::byte{255};
+    }
+  }
+
+  const auto& device = context_->device();
+  const auto texture = wgpu_utils::create_texture_2d(device, wgpu::TextureFormat::RGBA8Unorm, size, size, texels,
+                                                     mipmaps_enabled_, "Pattern texture");
+  if (mipmaps_enabled_) {
+    queueMipGeneration(texture);
+  }
+  pattern_view_ = wgpu_utils::create_texture_view(texture);
+  pattern_sampler_ = wgpu_utils::create_trilinear_sampler(device);
+}
+
+// Place `instance_count` copies of the mesh in groups arranged around a circle. Only the leaves are drawn, so they
+// are added after the root and the groups. Each group's leaves are added together, so that spinning a group dirties
+// its own node plus one run of leaves.
+void QWGPUWidget::setSceneDemoSize(const std::uint32_t instance_count) {
+  constexpr std::uint32_t group_count = 8;
+  constexpr float group_radius = 0.6f;
+  constexpr float group_extent = 0.35f;
+
+  scene_ = {};
+  scene_groups_.clear();
+  scene_root_ = scene_.add_node(wgpu_utils::scene_graph::no_parent);
+  scene_first_drawn_ = scene_root_;
+  if (instance_count == 0) {
+    return;
+  }
+
+  for (std::uint32_t g = 0; g < group_count; ++g) {
+    const float angle = 2.0f * std::numbers::pi_v<float> * static_cast<float>(g) / group_count;
+    wgpu_utils::transform local{};
+    local.translation = {group_radius * std::cos(angle), 0.0f, group_radius * std::sin(angle)};
+    scene_groups_.push_back(scene_.add_node(scene_root_, local));
+  }
+  scene_group_angles_.assign(group_count, 0.0f);
+  scene_first_drawn_ = scene_.size();
+
+  // Each group is a square grid in its local XY plane.
+  const std::uint32_t per_group = (instance_count + group_count - 1) / group_count;
+  const auto side = static_cast<std::uint32_t>(std::ceil(std::sqrt(static_cast<float>(per_group))));
+  const float spacing = group_extent / static_cast<float>(side);
+  for (std::uint32_t i = 0; i < instance_count; ++i) {
+    const std::uint32_t cell = i % per_group;
+    wgpu_utils::transform local{};
+    local.translation = {(static_cast<float>(cell % side) + 0.5f) * spacing - 0.5f * group_extent,
+                         (static_cast<float>(cell / side) + 0.5f) * spacing - 0.5f * group_extent, 0.0f};
+    local.scale = {0.8f * spacing, 0.8f * spacing, 0.8f * spacing};
+    scene_.add_node(scene_groups_[i / per_group], local);
+  }
+}
+
+// Without the demo, the scene is just the root, and spins about the vertical axis. In the demo, one group at a time
+// spins, so each frame only that group's subtree, about an eighth of the scene, is recomputed and uploaded.
+void QWGPUWidget::animateScene(const float time_seconds) {
+  constexpr std::array<float, 3> up{0.0f, 1.0f, 0.0f};
+  const float dt = scene_last_time_ ? time_seconds - *scene_last_time_ : 0.0f;
+  scene_last_time_ = time_seconds;
+  if (scene_groups_.empty()) {
+    scene_.set_rotation(scene_root_, wgpu_utils::axis_angle_rotation(up, 0.2f * time_seconds));
+    return;
+  }
+  const std::size_t active = static_cast<std::size_t>(time_seconds / 2.0f) % scene_groups_.size();
+  scene_group_angles_[active] += 2.0f * dt;
+  scene_.set_rotation(scene_groups_[active], wgpu_utils::axis_angle_rotation(up, scene_group_angles_[active]));
+}
+
+// Redraw the frame rate and latency readout once a second. Only the HUD rect is re-uploaded.
+void QWGPUWidget::updateHud() {
+  ++hud_frame_count_;
+  const auto now = std::chrono::steady_clock::now();
+  if (hud_last_update_ && now - *hud_last_update_ < std::chrono::seconds(1)) {
+    return;
+  }
+  const double seconds = hud_last_update_ ? std::chrono::duration<double>(now - *hud_last_update_).count() : 0.0;
+  const QString fps_text =
+      seconds > 0.0 ? QString("%1 fps").arg(hud_frame_count_ / seconds, 0, 'f', 1) : QStringLiteral("- fps");
+  hud_frame_count_ = 0;
+  hud_last_update_ = now;
+
+  const auto latency = frame_pacer_.stats();
+  const QString latency_text = QString("GPU latency %1 ms (max %2), %3/%4 in flight, %5 skipped")
+                                   .arg(latency.mean.count() / 1000.0, 0, 'f', 1)
+                                   .arg(latency.max.count() / 1000.0, 0, 'f', 1)
+                                   .arg(latency.frames_in_flight)
+                                   .arg(frame_pacer_.max_frames_in_flight())
+                                   .arg(latency.frames_skipped);
+
+  QStringList lines{fps_text, latency_text};
+  const auto input_latency = input_latency_.stats();
+  if (input_latency.frame_count > 0) {
+    lines << QString("Input to present %1 / %2 / %3 ms (p50 / p95 / p99)")
+                 .arg(input_latency.to_present.p50.count() / 1000.0, 0, 'f', 1)
+                 .arg(input_latency.to_present.p95.count() / 1000.0, 0, 'f', 1)
+                 .arg(input_latency.to_present.p99.count() / 1000.0, 0, 'f', 1);
+  }
+  if (input_latency_.marker_enabled()) {
+    lines << QString("Latency markers: %1/%2 matched")
+                 .arg(input_latency.markers_matched)
+                 .arg(input_latency.markers_checked);
+  }
+  if (!scene_groups_.empty()) {
+    lines << QString("Scene: %1 nodes, %2 updated in %3 ranges, %4 KiB uploaded")
+                 .arg(scene_.size())
+                 .arg(scene_last_update_.updated_nodes)
+                 .arg(scene_last_update_.ranges.size())
+                 .arg(scene_transforms_.last_upload_size() / 1024.0, 0, 'f', 1);
+  }
+  const QString text = lines.join('\n');
+
+  const QRect hud_rect{8, 8, 480, 14 + 16 * static_cast<int>(lines.size())};
+  overlay_.paint(hud_rect, [&](QPainter& painter) {
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(0, 0, 0, 160));
+    painter.drawRoundedRect(hud_rect, 4, 4);
+    painter.setPen(Qt::white);
+    painter.drawText(hud_rect.adjusted(8, 4, -8, -4), Qt::AlignTop | Qt::AlignLeft, text);
+  });
 }
 
 void QWGPUWidget::onFrameTimerFired() {
   WGPU_ERROR_FUNCTION_SCOPE(context_->device());
 
-  // Only value supported by WGPU, AFAIK.
-  constexpr std::uint32_t sample_count = 4;
+  // Don't queue more work while the GPU is too far behind.
+  if (!frame_pacer_.begin_frame(context_->device())) {
+    return;
+  }
+  const bool consumes_input = input_latency_.begin_frame();
+
+  const std::uint32_t sample_count = sample_count_;
 
   if (width_ != this->width() || height_ != this->height()) {
     // TODO: These dimensions probably don't account for retina displays on mac.
     width_ = this->width();
     height_ = this->height();
-    context_->configure_surface(static_cast<std::uint32_t>(width_), static_cast<std::uint32_t>(height_));
-
-    // Create a color + depth texture suitable for MSAA rendering.
-    msaa_texture_ = wgpu_utils::create_multisample_texure(context_->device(), context_->surface_format().value(),
-                                                          static_cast<std::uint32_t>(width_),
-                                                          static_cast<std::uint32_t>(height_), sample_count);
+    // The latency marker is read back from the surface texture.
+    constexpr wgpu::TextureUsage marker_usage = wgpu::TextureUsage::CopySrc;
+    if (input_latency_.marker_enabled() && (context_->surface_usages() & marker_usage) != marker_usage) {
+      qWarning("Surface textures can't be copied from, disabling the latency marker.");
+      input_latency_.set_marker_enabled(false);
+    }
+    context_->configure_surface(static_cast<std::uint32_t>(width_), static_cast<std::uint32_t>(height_),
+                                input_latency_.marker_enabled() ? marker_usage : wgpu::TextureUsage::None);
+
+    // Create a color + depth texture suitable for MSAA rendering. Without MSAA we render straight to the surface.
+    msaa_texture_ = sample_count > 1 ? wgpu_utils::create_multisample_texure(
+                                           context_->device(), context_->surface_format().value(),
+                                           static_cast<std::uint32_t>(width_), static_cast<std::uint32_t>(height_),
+                                           sample_count)
+                                     : wgpu::Texture{};
 
     depth_texture_ = wgpu_utils::create_depth_texture(context_->device(), static_cast<std::uint32_t>(width_),
                                                       static_cast<std::uint32_t>(height_), sample_count);
 
+    overlay_.resize(width_, height_);
+
     qInfo("Configured surface: %i x %i (window size is %i x %i)", width_, height_, this->window()->width(),
           this->window()->height());
   }
 
-  if (!pipeline_) {
-    qInfo("Creating render pipeline...");
-    std::tie(pipeline_, bg_layout_) =
-        make_toy_render_pipeline(context_->device(), context_->surface_format().value(), sample_count);
+  if (!toy_pipelines_) {
+    // Variants are compiled from one module, the first time each is drawn.
+    const auto shader = wgpu_utils::make_toy_shader_module(context_->device());
+    toy_pipelines_.emplace([device = context_->device(), shader](const wgpu_utils::toy_pipeline_key& key) {
+      qInfo("Creating toy pipeline variant: colors %i, texture %i, coverage %i, %u samples", key.vertex_colors,
+            key.textured, key.alpha_to_coverage, key.sample_count);
+      return wgpu_utils::make_toy_render_pipeline(device, shader, key);
+    });
 
     wgpu::BufferDescriptor descriptor{};
     descriptor.size = 16;
     descriptor.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
     descriptor.label = "Uniform buffer";
-    uniform_buffer_ = context_->device().CreateBuffer(&descriptor);
+    uniform_buffer_ = wgpu_utils::create_buffer(context_->device(), descriptor);
+
+    createPatternTexture();
+  }
+
+  if (mesh_path_) {
+    loadMeshResources(sample_count);
+  }
+  if (vertex_heap_) {
+    vertex_heap_->release_completed(frame_pacer_.completed_serial());
+    index_heap_->release_completed(frame_pacer_.completed_serial());
   }
 
   // Get a texture view for our target surface:
-  auto target_view = wgpu_utils::get_next_surface_texture_view(context_->device(), context_->surface());
+  const auto target_texture = wgpu_utils::get_next_surface_texture(context_->device(), context_->surface());
+  const auto target_view = wgpu_utils::create_surface_texture_view(target_texture);
   Q_ASSERT(target_view);
 
   // Create a bundle encoder so we can do multi-sampled rendering:
@@ -293,63 +499,302 @@ void QWGPUWidget::onFrameTimerFired() {
   encoder_desc.colorFormats = &surface_format;
   encoder_desc.label = "Bundle encoder";
   encoder_desc.depthStencilFormat = wgpu::TextureFormat::Depth32Float;
-  const wgpu::RenderBundleEncoder bundle_encoder = context_->device().CreateRenderBundleEncoder(&encoder_desc);
-  Q_ASSERT(bundle_encoder);
+  const wgpu_utils::traced_bundle_encoder bundle_encoder{context_->device().CreateRenderBundleEncoder(&encoder_desc)};
+  Q_ASSERT(bundle_encoder.get());
+  if (capture_) {
+    capture_->begin_frame(static_cast<std::uint32_t>(width_), static_cast<std::uint32_t>(height_), surface_format,
+                          sample_count);
+  }
 
   const wgpu::Queue queue = context_->device().GetQueue();
   Q_ASSERT(queue);
 
-  // Draw our toy pipeline:
+  // Draw our toy pipeline. Alpha to coverage needs MSAA, so that switch is dropped without it.
+  wgpu_utils::toy_pipeline_key toy_key = quad_key_;
+  toy_key.format = surface_format;
+  toy_key.sample_count = sample_count;
+  toy_key.alpha_to_coverage = toy_key.alpha_to_coverage && sample_count > 1;
+  const auto& [toy_pipeline, toy_bg_layout] = toy_pipelines_->get(toy_key);
+
   // First update the uniform value with elapsed time.
   const auto time_elapsed =
       std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time_.value());
   const float buffer_values[4] = {static_cast<float>(time_elapsed.count()) / 1.0e6f, 0.0f, 0.0f, 0.0f};
-  queue.WriteBuffer(uniform_buffer_, 0, &buffer_values, sizeof(buffer_values));
-
-  // Create bind group with our uniform buffer.
-  wgpu::BindGroupEntry binding{};
-  binding.binding = 0;
-  binding.buffer = uniform_buffer_;
-  binding.offset = 0;
-  binding.size = sizeof(buffer_values);
+  wgpu_utils::write_buffer(queue, uniform_buffer_, 0, &buffer_values, sizeof(buffer_values));
+
+  // Create bind group with our uniform buffer and the pattern.
+  wgpu::BindGroupEntry bindings[3]{};
+  bindings[0].binding = 0;
+  bindings[0].buffer = uniform_buffer_;
+  bindings[0].offset = 0;
+  bindings[0].size = sizeof(buffer_values);
+  bindings[1].binding = 1;
+  bindings[1].textureView = pattern_view_;
+  bindings[2].binding = 2;
+  bindings[2].sampler = pattern_sampler_;
   wgpu::BindGroupDescriptor bind_group_desc{};
-  bind_group_desc.layout = bg_layout_;
-  bind_group_desc.entryCount = 1;
-  bind_group_desc.entries = &binding;
-  const auto bg = context_->device().CreateBindGroup(&bind_group_desc);
-
-  // Draw the quad...
-  bundle_encoder.SetPipeline(pipeline_);
-  bundle_encoder.SetBindGroup(0, bg, 0, nullptr);
-  bundle_encoder.Draw(6, 1, 0, 0);
-
-  wgpu::RenderBundleDescriptor out{};
-  const auto bundle = bundle_encoder.Finish(&out);
+  bind_group_desc.layout = toy_bg_layout;
+  bind_group_desc.entryCount = 3;
+  bind_group_desc.entries = bindings;
+  const auto bg = wgpu_utils::create_bind_group(context_->device(), bind_group_desc);
+
+  if (mesh_pipeline_) {
+    // Draw the mesh in place of the quad.
+    const float mesh_values[8] = {buffer_values[0], mesh_scale_,     0.0f,           0.0f,
+                                  mesh_center_[0],  mesh_center_[1], mesh_center_[2], 0.0f};
+    wgpu_utils::write_buffer(queue, mesh_uniform_buffer_, 0, &mesh_values, sizeof(mesh_values));
+
+    wgpu::BindGroupEntry mesh_binding{};
+    mesh_binding.binding = 0;
+    mesh_binding.buffer = mesh_uniform_buffer_;
+    mesh_binding.offset = 0;
+    mesh_binding.size = sizeof(mesh_values);
+
+    // Draw one instance per scene node, from `scene_first_drawn_` onwards.
+    animateScene(buffer_values[0]);
+    scene_last_update_ = scene_.update();
+    scene_transforms_.upload(context_->device(), scene_, scene_last_update_);
+    const std::uint32_t instance_count = scene_.size() - scene_first_drawn_;
+
+    wgpu::BindGroupEntry mesh_bindings[2]{mesh_binding, {}};
+    mesh_bindings[1].binding = 1;
+    mesh_bindings[1].buffer = scene_transforms_.buffer();
+    mesh_bindings[1].offset = 0;
+    mesh_bindings[1].size = scene_transforms_.buffer().GetSize();
+    wgpu::BindGroupDescriptor mesh_bind_group_desc{};
+    mesh_bind_group_desc.layout = mesh_bg_layout_;
+    mesh_bind_group_desc.entryCount = 2;
+    mesh_bind_group_desc.entries = mesh_bindings;
+    const auto mesh_bg = wgpu_utils::create_bind_group(context_->device(), mesh_bind_group_desc);
+
+    bundle_encoder.set_pipeline(mesh_pipeline_);
+    bundle_encoder.set_bind_group(0, mesh_bg);
+    // One draw per part of a mesh that was split over several buffers.
+    for (const auto& [range, vertex_count] : mesh_.vertices) {
+      bundle_encoder.set_vertex_buffer(0, range.buffer, range.offset, range.size);
+      if (mesh_.indices.empty()) {
+        bundle_encoder.draw(vertex_count, instance_count, 0, scene_first_drawn_);
+      }
+    }
+    for (const auto& [range, index_count] : mesh_.indices) {
+      bundle_encoder.set_index_buffer(range.buffer, mesh_.index_format, range.offset, range.size);
+      bundle_encoder.draw_indexed(index_count, instance_count, 0, 0, scene_first_drawn_);
+    }
+  } else {
+    // Draw the quad...
+    bundle_encoder.set_pipeline(toy_pipeline);
+    bundle_encoder.set_bind_group(0, bg);
+    bundle_encoder.draw(6);
+  }
+
+  if (plot_demo_enabled_) {
+    updatePlotDemo(static_cast<double>(time_elapsed.count()) / 1.0e6);
+  }
+  if (!plot_series_ && !plot_pending_.empty()) {
+    createPlotResources(sample_count);
+  }
+  if (plot_series_) {
+    plot_series_->append(queue, plot_pending_);
+    plot_pending_.clear();
+
+    // Show the newest samples, scrolling along the time axis. Only the samples inside the window are drawn.
+    const wgpu_utils::plot_window visible = plot_series_->visible(plot_window_seconds_);
+    wgpu_utils::plot_uniforms plot_values = plot_series_->uniforms(visible, plot_window_seconds_, -1.25f, 1.25f);
+    plot_values.color[0] = 0.2f;
+    plot_values.color[1] = 0.8f;
+    plot_values.color[2] = 1.0f;
+    plot_values.color[3] = 0.6f;
+    wgpu_utils::write_buffer(queue, plot_line_uniform_buffer_, 0, &plot_values, sizeof(plot_values));
+    plot_values.color[0] = 1.0f;
+    plot_values.color[1] = 0.9f;
+    plot_values.color[2] = 0.3f;
+    plot_values.color[3] = 1.0f;
+    wgpu_utils::write_buffer(queue, plot_point_uniform_buffer_, 0, &plot_values, sizeof(plot_values));
+
+    bundle_encoder.set_pipeline(plot_line_pipeline_);
+    bundle_encoder.set_bind_group(0, plot_line_bg_);
+    bundle_encoder.draw(visible.count);
+    bundle_encoder.set_pipeline(plot_point_pipeline_);
+    bundle_encoder.set_bind_group(0, plot_point_bg_);
+    bundle_encoder.draw(visible.count);
+  }
+
+  // Composite QPainter content last, over everything else.
+  updateHud();
+  overlay_.upload(context_->device(), queue);
+  overlay_.draw(context_->device(), bundle_encoder, surface_format, sample_count);
+
+  const auto bundle = bundle_encoder.finish();
   Q_ASSERT(bundle);
 
   wgpu::CommandEncoderDescriptor command_encoder_desc{};
   const auto command_encoder = context_->device().CreateCommandEncoder(&command_encoder_desc);
   Q_ASSERT(command_encoder);
 
+  // Fill the mip chains of textures queued since the last frame, before anything samples them.
+  if (!pending_mips_.empty()) {
+    if (!mip_generator_) {
+      mip_generator_.emplace(context_->device());
+    }
+    mip_generator_->generate(command_encoder, pending_mips_);
+    pending_mips_.clear();
+  }
+
   // Execute the render bundle and submit to the command queue:
   const auto render_pass_encoder = make_render_pass_encoder_with_targets(command_encoder, target_view, msaa_texture_,
                                                                          depth_texture_, "Main render pass");
   Q_ASSERT(render_pass_encoder);
 
   render_pass_encoder.ExecuteBundles(1, &bundle);
+  // Drawn last, so nothing can cover the marker.
+  if (consumes_input) {
+    input_latency_.draw_marker(context_->device(), render_pass_encoder, surface_format, sample_count,
+                               static_cast<std::uint32_t>(width_), static_cast<std::uint32_t>(height_));
+  }
   render_pass_encoder.End();
 
   wgpu::CommandBufferDescriptor cmd_buffer_descriptor{};
   const wgpu::CommandBuffer command = command_encoder.Finish(&cmd_buffer_descriptor);
 
   queue.Submit(1, &command);
+  frame_pacer_.end_frame(queue);
+  input_latency_.frame_submitted(queue);
+  input_latency_.submit_marker_readback(context_->device(), target_texture);
+  if (capture_) {
+    capture_->end_frame();
+    if (capture_->failed() || capture_->frame_count() >= capture_frame_limit_) {
+      stopCapture();
+    }
+  }
 
   context_->surface().Present();
-  context_->device().Tick();
+  input_latency_.frame_presented();
+  if (frame_pacer_.poll(context_->device()) > 0 && !completion_timer_.isActive()) {
+    completion_timer_.start();
+  }
+}
+
+// Poll for completed frames between timer ticks, and stop once none are left in flight.
+void QWGPUWidget::onCompletionTimerFired() {
+  if (frame_pacer_.poll(context_->device()) == 0) {
+    completion_timer_.stop();
+  }
+}
+
+void QWGPUWidget::setDeviceProfile(const wgpu_utils::device_profile_kind kind) {
+  // The trace header records the profile when the capture starts.
+  Q_ASSERT(!context_ && !capture_);
+  profile_kind_ = kind;
+}
+
+bool QWGPUWidget::startCapture(const QString& path, const std::uint64_t frame_count) {
+  Q_ASSERT(!context_);
+  capture_ = wgpu_utils::capture_writer::open(path.toStdString(), profile_kind_);
+  if (!capture_) {
+    return false;
+  }
+  capture_frame_limit_ = frame_count;
+  wgpu_utils::set_active_capture(capture_.get());
+  return true;
+}
+
+void QWGPUWidget::stopCapture() {
+  if (!capture_) {
+    return;
+  }
+  if (capture_->flush()) {
+    fmt::print("Captured {} frames ({} KiB)\n", capture_->frame_count(), capture_->bytes_written() >> 10);
+  } else {
+    fmt::print("Capture failed after {} frames, the trace is incomplete\n", capture_->frame_count());
+  }
+  capture_.reset();
+}
+
+void QWGPUWidget::setFramePacing(const std::uint32_t max_frames_in_flight, const wgpu_utils::frame_pacing_mode mode) {
+  // A new pacer restarts the frame serials, which deferred heap frees and completion callbacks are tagged with.
+  Q_ASSERT(!context_);
+  frame_pacer_ = wgpu_utils::frame_pacer(max_frames_in_flight, mode);
+}
+
+void QWGPUWidget::queueMipGeneration(const wgpu::Texture& texture) {
+  Q_ASSERT(wgpu_utils::mip_generator::supports(texture.GetFormat()));
+  pending_mips_.push_back(texture);
+}
+
+// Safe to call at any time: the mesh is swapped on the next frame.
+void QWGPUWidget::loadMesh(const QString& path) { mesh_path_ = path.toStdString(); }
+
+void QWGPUWidget::appendSamples(const std::span<const wgpu_utils::plot_sample> samples) {
+  plot_pending_.insert(plot_pending_.end(), samples.begin(), samples.end());
+  // Samples beyond the capacity would be overwritten by this same upload, so don't hold on to them.
+  if (plot_pending_.size() > 2 * static_cast<std::size_t>(plot_capacity_)) {
+    plot_pending_.erase(plot_pending_.begin(), plot_pending_.end() - plot_capacity_);
+  }
 }
 
+void QWGPUWidget::setPlotCapacity(const std::uint32_t capacity) {
+  Q_ASSERT(!plot_series_ && plot_pending_.empty());
+  Q_ASSERT(capacity > 0);
+  plot_capacity_ = capacity;
+}
+
+void QWGPUWidget::setPlotWindow(const double seconds) {
+  Q_ASSERT(seconds > 0.0);
+  plot_window_seconds_ = seconds;
+}
+
+void QWGPUWidget::setPlotDemoEnabled(const bool enabled) { plot_demo_enabled_ = enabled; }
+
 QPaintEngine* QWGPUWidget::paintEngine() const { return nullptr; }
 
+void QWGPUWidget::setSampleCount(const std::uint32_t sample_count) {
+  Q_ASSERT(!context_);
+  Q_ASSERT(sample_count == 1 || sample_count == 4);
+  sample_count_ = sample_count;
+}
+
+void QWGPUWidget::setQuadSwitches(const bool vertex_colors, const bool textured, const bool alpha_to_coverage) {
+  quad_key_.vertex_colors = vertex_colors;
+  quad_key_.textured = textured;
+  quad_key_.alpha_to_coverage = alpha_to_coverage;
+}
+
+void QWGPUWidget::setMipmapsEnabled(const bool enabled) {
+  Q_ASSERT(!context_);
+  mipmaps_enabled_ = enabled;
+}
+
+void QWGPUWidget::setLatencyMarkerEnabled(const bool enabled) {
+  Q_ASSERT(!context_);
+  input_latency_.set_marker_enabled(enabled);
+}
+
+// Timestamp input as early as we see it, before it is dispatched to a handler.
+bool QWGPUWidget::event(QEvent* event) {
+  if (event->isInputEvent()) {
+    input_latency_.record_input();
+  }
+  return QWidget::event(event);
+}
+
+// Toggle the quad's switches: each new combination is compiled once, then reused.
+void QWGPUWidget::keyPressEvent(QKeyEvent* event) {
+  switch (event->key()) {
+    case Qt::Key_C:
+      quad_key_.vertex_colors = !quad_key_.vertex_colors;
+      break;
+    case Qt::Key_T:
+      quad_key_.textured = !quad_key_.textured;
+      break;
+    case Qt::Key_A:
+      quad_key_.alpha_to_coverage = !quad_key_.alpha_to_coverage;
+      break;
+    default:
+      QWidget::keyPressEvent(event);
+      break;
+  }
+}
+
 void QWGPUWidget::paintEvent(QPaintEvent*) {}
 
 void QWGPUWidget::showEvent(QShowEvent* event) {
@@ -364,7 +809,7 @@ void QWGPUWidget::showEvent(QShowEvent* event) {
     Q_ASSERT(surface);
 
     qInfo("Requesting adapter and device...");
-    context_ = wgpu_utils::wgpu_context(instance, surface);
+    context_ = wgpu_utils::wgpu_context(instance, surface, wgpu_utils::make_device_profile(profile_kind_));
 
     emit deviceInitialized();
   }
@@ -4,10 +4,23 @@
 #include <QWidget>
 
 #include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <webgpu/webgpu_cpp.h>
 
+#include "QWGPUOverlay.h"
+#include "wgpu_capture.hpp"
 #include "wgpu_context.hpp"
+#include "wgpu_frame_pacer.hpp"
+#include "wgpu_input_latency.hpp"
+#include "wgpu_mesh.hpp"
+#include "wgpu_mipmaps.hpp"
+#include "wgpu_pipeline_cache.hpp"
+#include "wgpu_pipelines.hpp"
+#include "wgpu_ring_buffer.hpp"
+#include "wgpu_scene.hpp"
 
 class QWGPUWidget : public QWidget {
   Q_OBJECT
@@ -18,18 +31,95 @@ class QWGPUWidget : public QWidget {
   void run();
   void stop();
 
+  // Select the device profile. Must be called before the widget is first shown, and before `startCapture`.
+  void setDeviceProfile(wgpu_utils::device_profile_kind kind);
+
+  // Record resource creation, uploads and draws to a trace file for `qt-wgpu-replay`, stopping after `frame_count`
+  // frames. Must be called before the widget is first shown, so that every resource the frames use is recorded.
+  bool startCapture(const QString& path, std::uint64_t frame_count);
+
+  // Close the trace early. Called automatically once the requested number of frames have been recorded, or when
+  // writing the trace fails.
+  void stopCapture();
+
+  // Limit how many frames may be queued on the GPU at once (1-3). Lower values reduce input-to-display latency. Must
+  // be called before the widget is first shown.
+  void setFramePacing(std::uint32_t max_frames_in_flight, wgpu_utils::frame_pacing_mode mode);
+
+  // CPU-submit to GPU-complete latency of recent frames.
+  wgpu_utils::frame_latency_stats frameLatencyStats() const { return frame_pacer_.stats(); }
+
+  // Latency from input events to the submit, GPU completion and present of the frame that first consumes them.
+  wgpu_utils::input_latency_stats inputLatencyStats() const { return input_latency_.stats(); }
+
+  // Test mode: draw a marker carrying their tag into frames that consume input, in the bottom-right corner, and read
+  // it back before present. See `input_latency_tracker`. Must be called before the widget is first shown.
+  void setLatencyMarkerEnabled(bool enabled);
+
+  // Render with MSAA (4), or without (1). Must be called before the widget is first shown.
+  void setSampleCount(std::uint32_t sample_count);
+
+  // Select the variant of the demo quad's shader. Press C, T or A to toggle these while running.
+  void setQuadSwitches(bool vertex_colors, bool textured, bool alpha_to_coverage);
+
+  // Generate mips for the pattern on the demo quad. Turn off to compare. Must be called before the widget is first
+  // shown.
+  void setMipmapsEnabled(bool enabled);
+
+  // Fill levels 1 and up of `texture` from level 0. Textures queued between frames are all generated in one compute
+  // pass at the start of the next frame. `texture` needs `mip_generator::required_usage`.
+  void queueMipGeneration(const wgpu::Texture& texture);
+
+  // Render the mesh file at `path` instead of the demo quad. The file is loaded once the device exists.
+  void loadMesh(const QString& path);
+
+  // Draw `instance_count` copies of the mesh, as leaves of a scene graph whose groups take turns spinning. Zero
+  // draws the mesh once. Must be called before the widget is first shown.
+  void setSceneDemoSize(std::uint32_t instance_count);
+
+  // Transforms of the mesh instances. Nodes from the first leaf onwards are each drawn as one instance.
+  wgpu_utils::scene_graph& scene() noexcept { return scene_; }
+
+  // Append samples to the streaming plot, in time order. The plot appears with the first samples. Safe to call at
+  // any time: samples are held until the device exists, and uploaded by the next frame.
+  void appendSamples(std::span<const wgpu_utils::plot_sample> samples);
+
+  // Number of samples the plot keeps. Must be called before the first samples are appended.
+  void setPlotCapacity(std::uint32_t capacity);
+
+  // Span of time the plot shows, ending at the newest sample.
+  void setPlotWindow(double seconds);
+
+  // Feed the plot a synthetic 20kHz sensor stream, through `appendSamples`.
+  void setPlotDemoEnabled(bool enabled);
+
+  // QPainter content drawn over the GPU view. Only regions painted since the last frame are re-uploaded.
+  QWGPUOverlay& overlay() noexcept { return overlay_; }
+
  signals:
   void deviceInitialized();
 
  private slots:
   void onFrameTimerFired();
+  void onCompletionTimerFired();
 
  private:
   QPaintEngine* paintEngine() const override;
+  bool event(QEvent* event) override;
+  void keyPressEvent(QKeyEvent* event) override;
   void paintEvent(QPaintEvent* event) override;
   void showEvent(QShowEvent* event) override;
   void resizeEvent(QResizeEvent*) override;
 
+  void createPatternTexture();
+  void loadMeshResources(std::uint32_t sample_count);
+  void releaseMesh();
+  void createPlotResources(std::uint32_t sample_count);
+  void updatePlotDemo(double time_seconds);
+  void animateScene(float time_seconds);
+  void updateHud();
+
+  wgpu_utils::device_profile_kind profile_kind_{wgpu_utils::default_device_profile_kind()};
   std::optional<wgpu_utils::wgpu_context> context_{};
   int width_{0};
   int height_{0};
@@ -38,11 +128,79 @@ class QWGPUWidget : public QWidget {
   wgpu::Texture msaa_texture_{};
   wgpu::Texture depth_texture_{};
 
-  // Pipeline and bind group layout for a simple triangle
-  wgpu::RenderPipeline pipeline_{};
-  wgpu::BindGroupLayout bg_layout_{};
+  std::uint32_t sample_count_{4};
+
+  // Variants of the pipeline for a simple quad, and the switches of the one to draw.
+  std::optional<wgpu_utils::pipeline_cache<wgpu_utils::toy_pipeline_key>> toy_pipelines_{};
+  wgpu_utils::toy_pipeline_key quad_key_{};
   wgpu::Buffer uniform_buffer_{};
 
+  // Mips are generated by one generator, for every texture queued since the last frame.
+  std::optional<wgpu_utils::mip_generator> mip_generator_{};
+  std::vector<wgpu::Texture> pending_mips_{};
+
+  // Pattern tiled across the quad, with a full mip chain unless disabled.
+  bool mipmaps_enabled_{true};
+  wgpu::TextureView pattern_view_{};
+  wgpu::Sampler pattern_sampler_{};
+
+  // Optional mesh loaded from disk, and the pipeline to draw it. Meshes are sub-allocated from shared heaps where
+  // they fit.
+  static constexpr std::uint64_t mesh_heap_size = 64 << 20;
+  std::optional<wgpu_utils::buffer_suballocator> vertex_heap_{};
+  std::optional<wgpu_utils::buffer_suballocator> index_heap_{};
+  std::optional<std::string> mesh_path_{};
+  wgpu_utils::mesh_buffers mesh_{};
+  wgpu::RenderPipeline mesh_pipeline_{};
+  wgpu::BindGroupLayout mesh_bg_layout_{};
+  wgpu::Buffer mesh_uniform_buffer_{};
+  std::array<float, 3> mesh_center_{};
+  float mesh_scale_{1.0f};
+
+  // Scene graph positioning mesh instances. World matrices are uploaded to a storage buffer the mesh shader indexes
+  // with `instance_index`, and only the range that changed is written each frame.
+  wgpu_utils::scene_graph scene_{};
+  wgpu_utils::scene_node scene_root_{0};
+  wgpu_utils::scene_node scene_first_drawn_{0};
+  std::vector<wgpu_utils::scene_node> scene_groups_{};
+  std::vector<float> scene_group_angles_{};
+  std::optional<float> scene_last_time_{};
+  wgpu_utils::scene_update scene_last_update_{};
+  wgpu_utils::scene_transform_buffer scene_transforms_{};
+
+  // Streaming plot: samples live in a GPU ring, and are drawn as a line strip with points on top. Appended samples
+  // wait in `plot_pending_` until the next frame uploads them.
+  std::uint32_t plot_capacity_{1 << 17};
+  double plot_window_seconds_{3.0};
+  std::vector<wgpu_utils::plot_sample> plot_pending_{};
+  bool plot_demo_enabled_{false};
+  std::uint64_t plot_demo_samples_generated_{0};
+  std::optional<wgpu_utils::plot_series> plot_series_{};
+  wgpu::BindGroupLayout plot_bg_layout_{};
+  wgpu::RenderPipeline plot_line_pipeline_{};
+  wgpu::RenderPipeline plot_point_pipeline_{};
+  wgpu::Buffer plot_line_uniform_buffer_{};
+  wgpu::Buffer plot_point_uniform_buffer_{};
+  wgpu::BindGroup plot_line_bg_{};
+  wgpu::BindGroup plot_point_bg_{};
+
+  // Frames are skipped rather than blocking the Qt event loop when too many are in flight. While any are, the device
+  // is polled every millisecond, so their completion is timestamped promptly instead of at the next frame.
+  wgpu_utils::frame_pacer frame_pacer_{2, wgpu_utils::frame_pacing_mode::skip};
+  QTimer completion_timer_;
+
+  // Input events are timestamped on arrival, and the next frame rendered is tracked until it is presented.
+  wgpu_utils::input_latency_tracker input_latency_{};
+
+  // Overlay, and the frame rate readout we draw into it.
+  QWGPUOverlay overlay_{};
+  int hud_frame_count_{0};
+  std::optional<std::chrono::steady_clock::time_point> hud_last_update_{};
+
+  // Trace being recorded, if any.
+  std::unique_ptr<wgpu_utils::capture_writer> capture_{};
+  std::uint64_t capture_frame_limit_{0};
+
   QTimer frame_timer_;
   std::optional<std::chrono::steady_clock::time_point> start_time_;
 };
@@ -1,10 +1,98 @@
 #include "MainWindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+
+#include "wgpu_setup.hpp"
 
 int main(int argc, char* argv[]) {
   QApplication a(argc, argv);
+
+  QCommandLineParser parser{};
+  parser.addHelpOption();
+  const QCommandLineOption mesh_option{"mesh", "Binary mesh file to render in place of the demo quad.", "file"};
+  parser.addOption(mesh_option);
+  const QCommandLineOption scene_option{"scene", "Draw this many instances of --mesh, arranged by a scene graph.",
+                                        "count"};
+  parser.addOption(scene_option);
+  const QCommandLineOption plot_option{"plot", "Stream a synthetic 20kHz signal into a scrolling plot."};
+  parser.addOption(plot_option);
+  const QCommandLineOption no_msaa_option{"no-msaa", "Render with one sample per pixel instead of 4x MSAA."};
+  parser.addOption(no_msaa_option);
+  const QCommandLineOption quad_option{
+      "quad", "Demo quad shader switches, comma separated: colors, texture, coverage. Defaults to colors,texture.",
+      "switches", "colors,texture"};
+  parser.addOption(quad_option);
+  const QCommandLineOption no_mipmaps_option{"no-mipmaps", "Don't generate mips for the demo quad's texture."};
+  parser.addOption(no_mipmaps_option);
+  const QCommandLineOption profile_option{
+      "profile", "Device profile: debug, production or low-power. Overrides QT_WGPU_PROFILE.", "name"};
+  parser.addOption(profile_option);
+  const QCommandLineOption frames_in_flight_option{
+      "frames-in-flight", "Maximum number of frames queued on the GPU (1-3). Defaults to 2.", "count"};
+  parser.addOption(frames_in_flight_option);
+  const QCommandLineOption latency_marker_option{
+      "latency-marker", "Draw a tag marker in frames that consume input, and read it back to check them."};
+  parser.addOption(latency_marker_option);
+  const QCommandLineOption capture_option{"capture", "Record a trace for qt-wgpu-replay to this file.", "file"};
+  parser.addOption(capture_option);
+  const QCommandLineOption capture_frames_option{
+      "capture-frames", "Number of frames to record with --capture. Defaults to 300.", "count", "300"};
+  parser.addOption(capture_frames_option);
+  parser.process(a);
+
   MainWindow w;
+  if (parser.isSet(profile_option)) {
+    const auto kind = wgpu_utils::parse_device_profile_kind(parser.value(profile_option).toStdString());
+    if (!kind) {
+      qFatal("Unknown device profile: %s", qPrintable(parser.value(profile_option)));
+    }
+    w.gpuWidget()->setDeviceProfile(*kind);
+  }
+  if (parser.isSet(frames_in_flight_option)) {
+    bool ok = false;
+    const std::uint32_t frames_in_flight = parser.value(frames_in_flight_option).toUInt(&ok);
+    if (!ok || frames_in_flight < 1 || frames_in_flight > 3) {
+      qFatal("Invalid --frames-in-flight, expected 1-3: %s", qPrintable(parser.value(frames_in_flight_option)));
+    }
+    w.gpuWidget()->setFramePacing(frames_in_flight, wgpu_utils::frame_pacing_mode::skip);
+  }
+  w.gpuWidget()->setSampleCount(parser.isSet(no_msaa_option) ? 1 : 4);
+  const QStringList quad_switches = parser.value(quad_option).split(',', Qt::SkipEmptyParts);
+  for (const QString& name : quad_switches) {
+    if (name != "colors" && name != "texture" && name != "coverage") {
+      qFatal("Unknown quad switch: %s", qPrintable(name));
+    }
+  }
+  w.gpuWidget()->setQuadSwitches(quad_switches.contains("colors"), quad_switches.contains("texture"),
+                                 quad_switches.contains("coverage"));
+  w.gpuWidget()->setMipmapsEnabled(!parser.isSet(no_mipmaps_option));
+  w.gpuWidget()->setLatencyMarkerEnabled(parser.isSet(latency_marker_option));
+  if (parser.isSet(capture_option)) {
+    bool ok = false;
+    const std::uint64_t capture_frames = parser.value(capture_frames_option).toULongLong(&ok);
+    if (!ok || capture_frames == 0) {
+      qFatal("Invalid --capture-frames: %s", qPrintable(parser.value(capture_frames_option)));
+    }
+    if (!w.gpuWidget()->startCapture(parser.value(capture_option), capture_frames)) {
+      qFatal("Could not start capture: %s", qPrintable(parser.value(capture_option)));
+    }
+  }
+  if (parser.isSet(mesh_option)) {
+    w.gpuWidget()->loadMesh(parser.value(mesh_option));
+  }
+  if (parser.isSet(scene_option)) {
+    if (!parser.isSet(mesh_option)) {
+      qFatal("--scene requires --mesh");
+    }
+    bool ok = false;
+    const std::uint32_t instance_count = parser.value(scene_option).toUInt(&ok);
+    if (!ok) {
+      qFatal("Invalid --scene count: %s", qPrintable(parser.value(scene_option)));
+    }
+    w.gpuWidget()->setSceneDemoSize(instance_count);
+  }
+  w.gpuWidget()->setPlotDemoEnabled(parser.isSet(plot_option));
   w.show();
   return a.exec();
 }
@@ -0,0 +1,129 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_context.hpp"
+#include "wgpu_fmt.hpp"
+#include "wgpu_setup.hpp"
+
+using std::chrono::microseconds;
+
+// Print mean and percentiles of one timing column, in milliseconds.
+static void print_summary(const char* const name, std::vector<microseconds> values) {
+  if (values.empty()) {
+    fmt::print("{:>16}: -\n", name);
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&](const double p) {
+    const auto index = static_cast<std::size_t>(std::lround(p * static_cast<double>(values.size() - 1)));
+    return values[index].count() / 1000.0;
+  };
+  microseconds total{0};
+  for (const microseconds value : values) {
+    total += value;
+  }
+  fmt::print("{:>16}: mean {:7.3f}  p50 {:7.3f}  p95 {:7.3f}  max {:7.3f} ms\n", name,
+             total.count() / 1000.0 / static_cast<double>(values.size()), percentile(0.5), percentile(0.95),
+             values.back().count() / 1000.0);
+}
+
+// Replay a trace recorded with `qt-wgpu --capture` on any adapter, and report per-frame timings.
+int main(int argc, char* argv[]) {
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser{};
+  parser.setApplicationDescription("Replay a qt-wgpu trace headlessly and report per-frame CPU and GPU timings.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("trace", "Trace file recorded with qt-wgpu --capture.");
+  const QCommandLineOption profile_option{
+      "profile", "Device profile: debug, production or low-power. Defaults to the profile the trace was recorded with.",
+      "name"};
+  parser.addOption(profile_option);
+  const QCommandLineOption trust_trace_option{
+      "trust-trace",
+      "Keep the profile's skip_validation and disable_robustness toggles. Only for traces you recorded yourself: a "
+      "corrupt trace can then access memory out of bounds instead of failing validation."};
+  parser.addOption(trust_trace_option);
+  const QCommandLineOption fallback_option{"fallback", "Use the CPU fallback adapter (SwiftShader)."};
+  parser.addOption(fallback_option);
+  const QCommandLineOption backend_option{"backend", "Only use adapters for this backend, e.g. vulkan or metal.",
+                                          "name"};
+  parser.addOption(backend_option);
+  const QCommandLineOption quiet_option{"quiet", "Only print the summary."};
+  parser.addOption(quiet_option);
+  parser.process(app);
+
+  if (parser.positionalArguments().size() != 1) {
+    parser.showHelp(1);
+  }
+
+  auto replayer = wgpu_utils::capture_replayer::open(parser.positionalArguments().front().toStdString());
+  if (!replayer) {
+    return 1;
+  }
+
+  std::optional<wgpu_utils::device_profile_kind> kind = replayer->profile();
+  if (parser.isSet(profile_option)) {
+    kind = wgpu_utils::parse_device_profile_kind(parser.value(profile_option).toStdString());
+    if (!kind) {
+      qFatal("Unknown device profile: %s", qPrintable(parser.value(profile_option)));
+    }
+  }
+  wgpu_utils::device_profile profile = wgpu_utils::make_device_profile(*kind);
+  // Handles, sizes and offsets all come from the trace, so keep validation and robustness on unless it is trusted.
+  if (!parser.isSet(trust_trace_option)) {
+    std::erase_if(profile.enabled_toggles, [](const std::string_view toggle) {
+      return toggle == "skip_validation" || toggle == "disable_robustness";
+    });
+  }
+  profile.force_fallback_adapter = parser.isSet(fallback_option);
+  if (parser.isSet(backend_option)) {
+    const auto backend = magic_enum::enum_cast<wgpu::BackendType>(parser.value(backend_option).toStdString(),
+                                                                  magic_enum::case_insensitive);
+    if (!backend) {
+      qFatal("Unknown backend: %s", qPrintable(parser.value(backend_option)));
+    }
+    profile.backend_type = *backend;
+  }
+
+  const wgpu::InstanceDescriptor desc{};
+  const auto instance = wgpu::CreateInstance(&desc);
+  Q_ASSERT(instance);
+  const wgpu_utils::wgpu_context context{instance, nullptr, profile};
+
+  const std::vector<wgpu_utils::replay_frame_timing> timings = replayer->replay(context.device());
+
+  std::vector<microseconds> cpu{};
+  std::vector<microseconds> gpu{};
+  std::vector<microseconds> submit_to_done{};
+  if (!parser.isSet(quiet_option)) {
+    fmt::print("{:>6} {:>10} {:>10} {:>10}\n", "frame", "cpu ms", "gpu ms", "done ms");
+  }
+  for (std::size_t i = 0; i < timings.size(); ++i) {
+    const auto& timing = timings[i];
+    cpu.push_back(timing.cpu);
+    submit_to_done.push_back(timing.submit_to_done);
+    if (timing.gpu) {
+      gpu.push_back(*timing.gpu);
+    }
+    if (!parser.isSet(quiet_option)) {
+      fmt::print("{:>6} {:>10.3f} {:>10} {:>10.3f}\n", i, timing.cpu.count() / 1000.0,
+                 timing.gpu ? fmt::format("{:.3f}", timing.gpu->count() / 1000.0) : std::string("-"),
+                 timing.submit_to_done.count() / 1000.0);
+    }
+  }
+
+  fmt::print("Replayed {} frames\n", timings.size());
+  print_summary("cpu", cpu);
+  print_summary("gpu", gpu);
+  print_summary("submit to done", submit_to_done);
+  return 0;
+}
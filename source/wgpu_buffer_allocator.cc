@@ -0,0 +1,303 @@
+#include "wgpu_buffer_allocator.hpp"
+
+#include <qassert.h>
+
+#include <algorithm>
+#include <bit>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_error_scope.hpp"
+
+namespace wgpu_utils {
+
+static constexpr std::uint64_t align_up(const std::uint64_t value, const std::uint64_t alignment) noexcept {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+tlsf_allocator::tlsf_allocator(const std::uint64_t size) : size_(size & ~(granularity - 1)) {
+  for (auto& heads : free_heads_) {
+    heads.fill(invalid_block);
+  }
+  if (size_ > 0) {
+    insert_free(new_block(0, size_));
+  }
+}
+
+void tlsf_allocator::mapping(const std::uint64_t size, std::uint32_t& fl, std::uint32_t& sl) noexcept {
+  if (size < sl_count) {
+    fl = 0;
+    sl = static_cast<std::uint32_t>(size);
+  } else {
+    const auto log2 = static_cast<std::uint32_t>(std::bit_width(size) - 1);
+    sl = static_cast<std::uint32_t>(size >> (log2 - sl_bits)) ^ sl_count;
+    fl = log2 - sl_bits + 1;
+  }
+}
+
+std::uint32_t tlsf_allocator::new_block(const std::uint64_t offset, const std::uint64_t size) {
+  block b{};
+  b.offset = offset;
+  b.size = size;
+  if (!unused_blocks_.empty()) {
+    const std::uint32_t index = unused_blocks_.back();
+    unused_blocks_.pop_back();
+    blocks_[index] = b;
+    return index;
+  }
+  blocks_.push_back(b);
+  return static_cast<std::uint32_t>(blocks_.size() - 1);
+}
+
+void tlsf_allocator::insert_free(const std::uint32_t index) {
+  block& b = blocks_[index];
+  std::uint32_t fl, sl;
+  mapping(b.size, fl, sl);
+  b.is_free = true;
+  b.prev_free = invalid_block;
+  b.next_free = free_heads_[fl][sl];
+  if (b.next_free != invalid_block) {
+    blocks_[b.next_free].prev_free = index;
+  }
+  free_heads_[fl][sl] = index;
+  fl_bitmap_ |= 1ull << fl;
+  sl_bitmaps_[fl] |= 1u << sl;
+}
+
+void tlsf_allocator::remove_free(const std::uint32_t index) {
+  block& b = blocks_[index];
+  std::uint32_t fl, sl;
+  mapping(b.size, fl, sl);
+  if (b.prev_free != invalid_block) {
+    blocks_[b.prev_free].next_free = b.next_free;
+  } else {
+    free_heads_[fl][sl] = b.next_free;
+    if (b.next_free == invalid_block) {
+      sl_bitmaps_[fl] &= ~(1u << sl);
+      if (sl_bitmaps_[fl] == 0) {
+        fl_bitmap_ &= ~(1ull << fl);
+      }
+    }
+  }
+  if (b.next_free != invalid_block) {
+    blocks_[b.next_free].prev_free = b.prev_free;
+  }
+  b.is_free = false;
+  b.prev_free = invalid_block;
+  b.next_free = invalid_block;
+}
+
+std::uint32_t tlsf_allocator::find_free(const std::uint64_t size) const {
+  // Round up to the next size class, so that any block in the chosen bin is large enough.
+  std::uint64_t rounded_size = size;
+  if (size >= sl_count) {
+    rounded_size += (1ull << (std::bit_width(size) - 1 - sl_bits)) - 1;
+  }
+  std::uint32_t fl, sl;
+  mapping(rounded_size, fl, sl);
+  if (fl < fl_count) {
+    std::uint32_t sl_map = sl_bitmaps_[fl] & (~0u << sl);
+    std::uint64_t fl_map = fl + 1 < 64 ? fl_bitmap_ & (~0ull << (fl + 1)) : 0;
+    if (sl_map != 0 || fl_map != 0) {
+      if (sl_map == 0) {
+        fl = static_cast<std::uint32_t>(std::countr_zero(fl_map));
+        sl_map = sl_bitmaps_[fl];
+      }
+      sl = static_cast<std::uint32_t>(std::countr_zero(sl_map));
+      return free_heads_[fl][sl];
+    }
+  }
+
+  // Nothing in a larger class, but the bin for `size` itself may still hold a block that fits.
+  mapping(size, fl, sl);
+  for (std::uint32_t i = free_heads_[fl][sl]; i != invalid_block; i = blocks_[i].next_free) {
+    if (blocks_[i].size >= size) {
+      return i;
+    }
+  }
+  return invalid_block;
+}
+
+std::uint32_t tlsf_allocator::split(const std::uint32_t index, const std::uint64_t size) {
+  const std::uint32_t remainder = new_block(blocks_[index].offset + size, blocks_[index].size - size);
+  // `new_block` may have reallocated `blocks_`, so index again from here on.
+  block& b = blocks_[index];
+  block& r = blocks_[remainder];
+  b.size = size;
+  r.prev_physical = index;
+  r.next_physical = b.next_physical;
+  if (r.next_physical != invalid_block) {
+    blocks_[r.next_physical].prev_physical = remainder;
+  }
+  b.next_physical = remainder;
+  return remainder;
+}
+
+void tlsf_allocator::merge(const std::uint32_t index, const std::uint32_t next) {
+  block& b = blocks_[index];
+  const block& n = blocks_[next];
+  Q_ASSERT(b.next_physical == next && b.offset + b.size == n.offset);
+  b.size += n.size;
+  b.next_physical = n.next_physical;
+  if (b.next_physical != invalid_block) {
+    blocks_[b.next_physical].prev_physical = index;
+  }
+  unused_blocks_.push_back(next);
+}
+
+tlsf_allocator::allocation tlsf_allocator::allocate(const std::uint64_t size, std::uint64_t alignment) {
+  Q_ASSERT(std::has_single_bit(alignment));
+  alignment = std::max(alignment, granularity);
+  const std::uint64_t aligned_size = align_up(std::max<std::uint64_t>(size, 1), granularity);
+
+  // Try for a block that fits as-is. If its offset is misaligned by too much, search again leaving room to move the
+  // start of the block up to the next multiple of `alignment`.
+  const auto fits = [&](const std::uint32_t i) {
+    return align_up(blocks_[i].offset, alignment) - blocks_[i].offset + aligned_size <= blocks_[i].size;
+  };
+  std::uint32_t index = find_free(aligned_size);
+  if (index != invalid_block && !fits(index)) {
+    index = find_free(aligned_size + alignment - granularity);
+  }
+  if (index == invalid_block) {
+    return {};
+  }
+  remove_free(index);
+
+  // Give any padding in front of the aligned offset back to the free lists.
+  const std::uint64_t padding = align_up(blocks_[index].offset, alignment) - blocks_[index].offset;
+  if (padding > 0) {
+    const std::uint32_t front = index;
+    index = split(front, padding);
+    insert_free(front);
+  }
+  if (blocks_[index].size > aligned_size) {
+    insert_free(split(index, aligned_size));
+  }
+
+  used_bytes_ += blocks_[index].size;
+  ++allocation_count_;
+  return allocation{blocks_[index].offset, size, index};
+}
+
+void tlsf_allocator::free(const allocation& allocation) {
+  Q_ASSERT(allocation && allocation.block < blocks_.size());
+  std::uint32_t index = allocation.block;
+  Q_ASSERT(!blocks_[index].is_free);
+  used_bytes_ -= blocks_[index].size;
+  --allocation_count_;
+
+  // Coalesce with free neighbours on either side.
+  const std::uint32_t prev = blocks_[index].prev_physical;
+  if (prev != invalid_block && blocks_[prev].is_free) {
+    remove_free(prev);
+    merge(prev, index);
+    index = prev;
+  }
+  const std::uint32_t next = blocks_[index].next_physical;
+  if (next != invalid_block && blocks_[next].is_free) {
+    remove_free(next);
+    merge(index, next);
+  }
+  insert_free(index);
+}
+
+allocator_stats tlsf_allocator::stats() const {
+  allocator_stats stats{};
+  stats.total_bytes = size_;
+  stats.used_bytes = used_bytes_;
+  stats.free_bytes = size_ - used_bytes_;
+  stats.allocation_count = allocation_count_;
+  for (std::uint32_t fl = 0; fl < fl_count; ++fl) {
+    for (std::uint32_t sl = 0; sl < sl_count; ++sl) {
+      for (std::uint32_t i = free_heads_[fl][sl]; i != invalid_block; i = blocks_[i].next_free) {
+        stats.largest_free_block = std::max(stats.largest_free_block, blocks_[i].size);
+        ++stats.free_block_count;
+      }
+    }
+  }
+  return stats;
+}
+
+static wgpu::BufferUsage buffer_usage_for_class(const buffer_usage_class usage_class) {
+  switch (usage_class) {
+    case buffer_usage_class::vertex:
+      return wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst;
+    case buffer_usage_class::index:
+      return wgpu::BufferUsage::Index | wgpu::BufferUsage::CopyDst;
+    case buffer_usage_class::storage:
+      return wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+  }
+  return wgpu::BufferUsage::CopyDst;
+}
+
+buffer_suballocator::buffer_suballocator(const wgpu::Device& device, const buffer_usage_class usage_class,
+                                         const std::uint64_t heap_size)
+    : device_(device), usage_class_(usage_class), heap_size_(heap_size), min_alignment_(4) {
+  if (usage_class == buffer_usage_class::storage) {
+    wgpu::Limits limits{};
+    if (device_.GetLimits(&limits)) {
+      min_alignment_ = limits.minStorageBufferOffsetAlignment;
+    }
+  }
+}
+
+buffer_allocation buffer_suballocator::allocate(const std::uint64_t size, std::uint64_t alignment) {
+  alignment = std::max(alignment, min_alignment_);
+  for (std::uint32_t h = 0; h < heaps_.size(); ++h) {
+    if (const auto a = heaps_[h].allocator.allocate(size, alignment); a) {
+      return buffer_allocation{heaps_[h].buffer, a.offset, a.size, h, a.block};
+    }
+  }
+
+  // No room anywhere: add a heap (larger than usual, if this one request needs it).
+  WGPU_ERROR_FUNCTION_SCOPE(device_);
+  wgpu::BufferDescriptor descriptor{};
+  descriptor.label = "Sub-allocated buffer heap";
+  descriptor.size = std::max(heap_size_, align_up(size, tlsf_allocator::granularity));
+  descriptor.usage = buffer_usage_for_class(usage_class_);
+  wgpu::Buffer buffer = create_buffer(device_, descriptor);
+  if (!buffer) {
+    return {};
+  }
+  heaps_.push_back(heap{buffer, tlsf_allocator{descriptor.size}});
+
+  const auto h = static_cast<std::uint32_t>(heaps_.size() - 1);
+  const auto a = heaps_[h].allocator.allocate(size, alignment);
+  Q_ASSERT(a);
+  return buffer_allocation{heaps_[h].buffer, a.offset, a.size, h, a.block};
+}
+
+void buffer_suballocator::free(const buffer_allocation& allocation, const std::uint64_t last_used_serial) {
+  Q_ASSERT(allocation.is_suballocated() && allocation.heap < heaps_.size());
+  pending_frees_.push_back(
+      pending_free{last_used_serial, allocation.heap, {allocation.offset, allocation.size, allocation.block}});
+}
+
+void buffer_suballocator::release_completed(const std::uint64_t completed_serial) {
+  const auto first_pending =
+      std::partition(pending_frees_.begin(), pending_frees_.end(),
+                     [&](const pending_free& pending) { return pending.serial <= completed_serial; });
+  for (auto it = pending_frees_.begin(); it != first_pending; ++it) {
+    heaps_[it->heap].allocator.free(it->allocation);
+  }
+  pending_frees_.erase(pending_frees_.begin(), first_pending);
+}
+
+allocator_stats buffer_suballocator::stats() const {
+  allocator_stats total{};
+  for (const heap& h : heaps_) {
+    const allocator_stats s = h.allocator.stats();
+    total.total_bytes += s.total_bytes;
+    total.used_bytes += s.used_bytes;
+    total.free_bytes += s.free_bytes;
+    total.largest_free_block = std::max(total.largest_free_block, s.largest_free_block);
+    total.allocation_count += s.allocation_count;
+    total.free_block_count += s.free_block_count;
+  }
+  for (const pending_free& pending : pending_frees_) {
+    total.pending_free_bytes += pending.allocation.size;
+  }
+  return total;
+}
+
+}  // namespace wgpu_utils
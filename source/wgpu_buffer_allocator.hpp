@@ -0,0 +1,159 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+// Statistics for a sub-allocated address range (or several of them).
+struct allocator_stats {
+  std::uint64_t total_bytes{0};
+  std::uint64_t used_bytes{0};
+  std::uint64_t free_bytes{0};
+  std::uint64_t largest_free_block{0};
+  std::uint32_t allocation_count{0};
+  std::uint32_t free_block_count{0};
+  // Bytes freed but still waiting for the GPU to finish with them.
+  std::uint64_t pending_free_bytes{0};
+
+  // 0 when all free space is contiguous, approaching 1 as it is split into many small blocks.
+  double fragmentation() const noexcept {
+    return free_bytes > 0 ? 1.0 - static_cast<double>(largest_free_block) / static_cast<double>(free_bytes) : 0.0;
+  }
+};
+
+// Two-level segregated fit (TLSF) allocator over the offsets [0, size). It only does bookkeeping - no memory is
+// touched - so it can manage the contents of a GPU buffer. Allocation and free are O(1): free blocks are binned
+// by size class (a power of two, subdivided linearly into 16), and two bitmaps find the first non-empty bin that is
+// large enough. Freed blocks are merged with free neighbours immediately.
+class tlsf_allocator {
+ public:
+  // Offsets and sizes are multiples of this.
+  static constexpr std::uint64_t granularity = 16;
+  static constexpr std::uint32_t invalid_block = std::numeric_limits<std::uint32_t>::max();
+
+  struct allocation {
+    std::uint64_t offset{0};
+    std::uint64_t size{0};
+    std::uint32_t block{invalid_block};
+
+    constexpr explicit operator bool() const noexcept { return block != invalid_block; }
+  };
+
+  explicit tlsf_allocator(std::uint64_t size);
+
+  // Allocate `size` bytes at an offset that is a multiple of `alignment` (a power of two). Returns an invalid
+  // allocation if there is no free block large enough.
+  allocation allocate(std::uint64_t size, std::uint64_t alignment = granularity);
+
+  void free(const allocation& allocation);
+
+  constexpr std::uint64_t size() const noexcept { return size_; }
+
+  allocator_stats stats() const;
+
+ private:
+  static constexpr std::uint32_t sl_bits = 4;
+  static constexpr std::uint32_t sl_count = 1u << sl_bits;
+  static constexpr std::uint32_t fl_count = 64 - sl_bits + 1;
+
+  struct block {
+    std::uint64_t offset;
+    std::uint64_t size;
+    // Neighbours in address order.
+    std::uint32_t prev_physical{invalid_block};
+    std::uint32_t next_physical{invalid_block};
+    // Neighbours in the free list for this block's size class.
+    std::uint32_t prev_free{invalid_block};
+    std::uint32_t next_free{invalid_block};
+    bool is_free{false};
+  };
+
+  // Size class of a block of `size` bytes.
+  static void mapping(std::uint64_t size, std::uint32_t& fl, std::uint32_t& sl) noexcept;
+
+  std::uint32_t new_block(std::uint64_t offset, std::uint64_t size);
+  void insert_free(std::uint32_t index);
+  void remove_free(std::uint32_t index);
+  // Find a free block of at least `size` bytes, or `invalid_block`.
+  std::uint32_t find_free(std::uint64_t size) const;
+  // Split `index` so it is `size` bytes long, returning the new block holding the remainder.
+  std::uint32_t split(std::uint32_t index, std::uint64_t size);
+  // Merge `next` into `index`. Both must be free and not in a free list.
+  void merge(std::uint32_t index, std::uint32_t next);
+
+  std::uint64_t size_;
+  std::vector<block> blocks_{};
+  std::vector<std::uint32_t> unused_blocks_{};
+  std::uint64_t fl_bitmap_{0};
+  std::array<std::uint32_t, fl_count> sl_bitmaps_{};
+  std::array<std::array<std::uint32_t, sl_count>, fl_count> free_heads_{};
+  std::uint64_t used_bytes_{0};
+  std::uint32_t allocation_count_{0};
+};
+
+// Kinds of buffer that are sub-allocated together.
+enum class buffer_usage_class { vertex, index, storage };
+
+// A range in one of the heaps owned by a `buffer_suballocator`, or a dedicated buffer if `heap` is invalid.
+struct buffer_allocation {
+  wgpu::Buffer buffer{};
+  std::uint64_t offset{0};
+  std::uint64_t size{0};
+  std::uint32_t heap{tlsf_allocator::invalid_block};
+  std::uint32_t block{tlsf_allocator::invalid_block};
+
+  constexpr bool is_suballocated() const noexcept { return heap != tlsf_allocator::invalid_block; }
+  explicit operator bool() const noexcept { return static_cast<bool>(buffer); }
+};
+
+// Sub-allocates vertex, index or storage data from a few large `wgpu::Buffer` heaps, so that loading and unloading
+// many small resources is offset bookkeeping rather than a buffer creation (and a new bind group) each time.
+//
+// Frees are deferred: a range is tagged with the serial of the last frame that may use it (see `frame_pacer`), and
+// only becomes available again once `release_completed` is called with a serial at least that large.
+class buffer_suballocator {
+ public:
+  buffer_suballocator(const wgpu::Device& device, buffer_usage_class usage_class, std::uint64_t heap_size);
+
+  // Allocate `size` bytes. The offset is aligned to at least `alignment`, and to the storage buffer offset alignment
+  // for storage heaps. A new heap is created if none has room. Requests larger than the heap size get a heap of
+  // their own.
+  buffer_allocation allocate(std::uint64_t size, std::uint64_t alignment = 4);
+
+  // Return a range once the GPU has finished the frame with serial `last_used_serial`.
+  void free(const buffer_allocation& allocation, std::uint64_t last_used_serial);
+
+  // Release every deferred free whose frame has completed on the GPU.
+  void release_completed(std::uint64_t completed_serial);
+
+  constexpr buffer_usage_class usage_class() const noexcept { return usage_class_; }
+  constexpr std::size_t heap_count() const noexcept { return heaps_.size(); }
+
+  // Aggregate over all heaps.
+  allocator_stats stats() const;
+
+ private:
+  struct heap {
+    wgpu::Buffer buffer;
+    tlsf_allocator allocator;
+  };
+
+  struct pending_free {
+    std::uint64_t serial;
+    std::uint32_t heap;
+    tlsf_allocator::allocation allocation;
+  };
+
+  wgpu::Device device_;
+  buffer_usage_class usage_class_;
+  std::uint64_t heap_size_;
+  std::uint64_t min_alignment_;
+  std::vector<heap> heaps_{};
+  std::vector<pending_free> pending_frees_{};
+};
+
+}  // namespace wgpu_utils
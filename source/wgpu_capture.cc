@@ -0,0 +1,855 @@
+#include "wgpu_capture.hpp"
+
+#include <QFile>
+#include <qassert.h>
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "wgpu_error_scope.hpp"
+#include "wgpu_fmt.hpp"
+#include "wgpu_mesh.hpp"
+#include "wgpu_mipmaps.hpp"
+#include "wgpu_pipelines.hpp"
+#include "wgpu_ring_buffer.hpp"
+#include "wgpu_textures.hpp"
+
+namespace wgpu_utils {
+
+std::unique_ptr<capture_writer> capture_writer::open(const std::string& path, const device_profile_kind profile) {
+  auto file = std::make_unique<QFile>(QString::fromStdString(path));
+  if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    fmt::print("Failed to open capture file: {} ({})\n", path, file->errorString().toStdString());
+    return nullptr;
+  }
+  capture_file_header header{};
+  header.profile = profile;
+  if (file->write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)) {
+    fmt::print("Failed to write capture file: {} ({})\n", path, file->errorString().toStdString());
+    return nullptr;
+  }
+  return std::unique_ptr<capture_writer>(new capture_writer(std::move(file)));
+}
+
+capture_writer::capture_writer(std::unique_ptr<QFile> file) : file_(std::move(file)) {}
+
+capture_writer::~capture_writer() {
+  if (active_capture() == this) {
+    set_active_capture(nullptr);
+  }
+  file_->close();
+}
+
+std::uint64_t capture_writer::bytes_written() const { return static_cast<std::uint64_t>(file_->pos()); }
+
+bool capture_writer::flush() {
+  if (!failed_ && !file_->flush()) {
+    fmt::print("Failed to write capture file: {} ({})\n", file_->fileName().toStdString(),
+               file_->errorString().toStdString());
+    failed_ = true;
+  }
+  return !failed_;
+}
+
+capture_id capture_writer::assign_id(const void* const handle) {
+  const capture_id id = next_id_++;
+  ids_[handle] = id;
+  return id;
+}
+
+capture_id capture_writer::find_id(const void* const handle) const {
+  if (handle == nullptr) {
+    return 0;
+  }
+  const auto it = ids_.find(handle);
+  return it != ids_.end() ? it->second : 0;
+}
+
+void capture_writer::write_record(const capture_op op, const void* const payload, const std::size_t payload_size,
+                                  const std::uint64_t data_size) {
+  capture_record_header header{};
+  header.op = op;
+  header.size = payload_size + data_size;
+  write_bytes(&header, sizeof(header));
+  write_bytes(payload, payload_size);
+}
+
+void capture_writer::write_data(const void* const data, const std::uint64_t size) { write_bytes(data, size); }
+
+void capture_writer::write_bytes(const void* const data, const std::uint64_t size) {
+  if (failed_) {
+    return;
+  }
+  if (file_->write(static_cast<const char*>(data), static_cast<qint64>(size)) != static_cast<qint64>(size)) {
+    fmt::print("Failed to write capture file: {} ({})\n", file_->fileName().toStdString(),
+               file_->errorString().toStdString());
+    failed_ = true;
+  }
+}
+
+void capture_writer::record_buffer(const wgpu::Buffer& buffer, const wgpu::BufferDescriptor& descriptor) {
+  if (!buffer) {
+    return;
+  }
+  capture_create_buffer record{};
+  record.id = assign_id(buffer.Get());
+  record.size = descriptor.size;
+  record.usage = static_cast<std::uint64_t>(descriptor.usage);
+  write_record(capture_op::create_buffer, &record, sizeof(record));
+}
+
+void capture_writer::record_write_buffer(const wgpu::Buffer& buffer, const std::uint64_t offset,
+                                         const void* const data, const std::size_t size) {
+  capture_write_buffer record{};
+  record.buffer = find_id(buffer.Get());
+  record.offset = offset;
+  write_record(capture_op::write_buffer, &record, sizeof(record), size);
+  write_data(data, size);
+}
+
+void capture_writer::record_texture(const wgpu::Texture& texture, const wgpu::TextureDescriptor& descriptor) {
+  if (!texture) {
+    return;
+  }
+  capture_create_texture record{};
+  record.id = assign_id(texture.Get());
+  record.format = descriptor.format;
+  record.dimension = descriptor.dimension;
+  record.width = descriptor.size.width;
+  record.height = descriptor.size.height;
+  record.depth_or_array_layers = descriptor.size.depthOrArrayLayers;
+  record.mip_level_count = descriptor.mipLevelCount;
+  record.sample_count = descriptor.sampleCount;
+  record.usage = static_cast<std::uint64_t>(descriptor.usage);
+  write_record(capture_op::create_texture, &record, sizeof(record));
+}
+
+void capture_writer::record_texture_view(const wgpu::TextureView& view, const wgpu::Texture& texture) {
+  if (view) {
+    view_textures_[view.Get()] = find_id(texture.Get());
+  }
+}
+
+void capture_writer::record_write_texture(const wgpu::TexelCopyTextureInfo& destination, const void* const data,
+                                          const std::size_t size, const wgpu::TexelCopyBufferLayout& layout,
+                                          const wgpu::Extent3D& extent) {
+  capture_write_texture record{};
+  record.texture = find_id(destination.texture.Get());
+  record.mip_level = destination.mipLevel;
+  record.origin[0] = destination.origin.x;
+  record.origin[1] = destination.origin.y;
+  record.origin[2] = destination.origin.z;
+  record.size[0] = extent.width;
+  record.size[1] = extent.height;
+  record.size[2] = extent.depthOrArrayLayers;
+
+  // Sub-rect uploads usually have a row pitch much wider than the rect. Store just the rows we need.
+  const auto* const bytes = static_cast<const std::byte*>(data) + layout.offset;
+  const std::uint32_t row_size = extent.width * texel_size(destination.texture.GetFormat());
+  const std::uint32_t rows_per_image =
+      layout.rowsPerImage != wgpu::kCopyStrideUndefined ? layout.rowsPerImage : extent.height;
+  if (row_size == 0 || row_size == layout.bytesPerRow || layout.bytesPerRow == wgpu::kCopyStrideUndefined) {
+    record.bytes_per_row = layout.bytesPerRow;
+    record.rows_per_image = layout.rowsPerImage;
+    write_record(capture_op::write_texture, &record, sizeof(record), size - layout.offset);
+    write_data(bytes, size - layout.offset);
+    return;
+  }
+
+  record.bytes_per_row = row_size;
+  record.rows_per_image = extent.height;
+  write_record(capture_op::write_texture, &record, sizeof(record),
+               static_cast<std::uint64_t>(row_size) * extent.height * extent.depthOrArrayLayers);
+  for (std::uint32_t z = 0; z < extent.depthOrArrayLayers; ++z) {
+    for (std::uint32_t y = 0; y < extent.height; ++y) {
+      write_data(bytes + (static_cast<std::uint64_t>(z) * rows_per_image + y) * layout.bytesPerRow, row_size);
+    }
+  }
+}
+
+void capture_writer::record_pipeline(const wgpu::RenderPipeline& pipeline, const wgpu::BindGroupLayout& layout,
+                                     const capture_pipeline_params& params) {
+  if (!pipeline) {
+    return;
+  }
+  capture_create_pipeline record{};
+  record.id = assign_id(pipeline.Get());
+  // Several pipelines may share a layout.
+  record.layout = find_id(layout.Get());
+  if (record.layout == 0) {
+    record.layout = assign_id(layout.Get());
+  }
+  record.params = params;
+  write_record(capture_op::create_pipeline, &record, sizeof(record));
+}
+
+void capture_writer::record_bind_group(const wgpu::BindGroup& bind_group, const wgpu::BindGroupDescriptor& descriptor) {
+  if (!bind_group) {
+    return;
+  }
+  capture_create_bind_group record{};
+  record.id = assign_id(bind_group.Get());
+  record.layout = find_id(descriptor.layout.Get());
+  record.entry_count = static_cast<std::uint32_t>(descriptor.entryCount);
+
+  std::vector<capture_bind_group_entry> entries(descriptor.entryCount);
+  for (std::size_t i = 0; i < descriptor.entryCount; ++i) {
+    const wgpu::BindGroupEntry& entry = descriptor.entries[i];
+    entries[i].binding = entry.binding;
+    entries[i].buffer = find_id(entry.buffer.Get());
+    if (entry.textureView) {
+      const auto it = view_textures_.find(entry.textureView.Get());
+      entries[i].texture = it != view_textures_.end() ? it->second : 0;
+    }
+    entries[i].sampler = entry.sampler ? 1 : 0;
+    entries[i].offset = entry.offset;
+    entries[i].size = entry.size;
+  }
+  write_record(capture_op::create_bind_group, &record, sizeof(record),
+               entries.size() * sizeof(capture_bind_group_entry));
+  write_data(entries.data(), entries.size() * sizeof(capture_bind_group_entry));
+}
+
+void capture_writer::record_generate_mips(const wgpu::Texture& texture) {
+  const capture_generate_mips record{find_id(texture.Get())};
+  write_record(capture_op::generate_mips, &record, sizeof(record));
+}
+
+void capture_writer::begin_frame(const std::uint32_t width, const std::uint32_t height,
+                                 const wgpu::TextureFormat format, const std::uint32_t sample_count) {
+  Q_ASSERT(!in_frame_);
+  in_frame_ = true;
+  const capture_begin_frame record{width, height, format, sample_count};
+  write_record(capture_op::begin_frame, &record, sizeof(record));
+}
+
+void capture_writer::end_frame() {
+  Q_ASSERT(in_frame_);
+  in_frame_ = false;
+  ++frame_count_;
+  write_record(capture_op::end_frame, nullptr, 0);
+}
+
+void capture_writer::record_set_pipeline(const wgpu::RenderPipeline& pipeline) {
+  const capture_set_pipeline record{find_id(pipeline.Get())};
+  write_record(capture_op::set_pipeline, &record, sizeof(record));
+}
+
+void capture_writer::record_set_bind_group(const std::uint32_t group, const wgpu::BindGroup& bind_group) {
+  const capture_set_bind_group record{group, find_id(bind_group.Get())};
+  write_record(capture_op::set_bind_group, &record, sizeof(record));
+}
+
+void capture_writer::record_set_vertex_buffer(const std::uint32_t slot, const wgpu::Buffer& buffer,
+                                              const std::uint64_t offset, const std::uint64_t size) {
+  const capture_set_vertex_buffer record{slot, find_id(buffer.Get()), offset, size};
+  write_record(capture_op::set_vertex_buffer, &record, sizeof(record));
+}
+
+void capture_writer::record_set_index_buffer(const wgpu::Buffer& buffer, const wgpu::IndexFormat format,
+                                             const std::uint64_t offset, const std::uint64_t size) {
+  const capture_set_index_buffer record{find_id(buffer.Get()), format, offset, size};
+  write_record(capture_op::set_index_buffer, &record, sizeof(record));
+}
+
+void capture_writer::record_draw(const std::uint32_t vertex_count, const std::uint32_t instance_count,
+                                 const std::uint32_t first_vertex, const std::uint32_t first_instance) {
+  const capture_draw record{vertex_count, instance_count, first_vertex, first_instance};
+  write_record(capture_op::draw, &record, sizeof(record));
+}
+
+void capture_writer::record_draw_indexed(const std::uint32_t index_count, const std::uint32_t instance_count,
+                                         const std::uint32_t first_index, const std::int32_t base_vertex,
+                                         const std::uint32_t first_instance) {
+  const capture_draw_indexed record{index_count, instance_count, first_index, base_vertex, first_instance};
+  write_record(capture_op::draw_indexed, &record, sizeof(record));
+}
+
+static capture_writer* g_active_capture = nullptr;
+
+capture_writer* active_capture() noexcept { return g_active_capture; }
+
+void set_active_capture(capture_writer* const capture) noexcept { g_active_capture = capture; }
+
+wgpu::Buffer create_buffer(const wgpu::Device& device, const wgpu::BufferDescriptor& descriptor) {
+  wgpu::Buffer buffer = device.CreateBuffer(&descriptor);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_buffer(buffer, descriptor);
+  }
+  return buffer;
+}
+
+void write_buffer(const wgpu::Queue& queue, const wgpu::Buffer& buffer, const std::uint64_t offset,
+                  const void* const data, const std::size_t size) {
+  queue.WriteBuffer(buffer, offset, data, size);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_write_buffer(buffer, offset, data, size);
+  }
+}
+
+wgpu::Texture create_texture(const wgpu::Device& device, const wgpu::TextureDescriptor& descriptor) {
+  wgpu::Texture texture = device.CreateTexture(&descriptor);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_texture(texture, descriptor);
+  }
+  return texture;
+}
+
+wgpu::TextureView create_texture_view(const wgpu::Texture& texture) {
+  wgpu::TextureView view = texture.CreateView();
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_texture_view(view, texture);
+  }
+  return view;
+}
+
+void write_texture(const wgpu::Queue& queue, const wgpu::TexelCopyTextureInfo& destination, const void* const data,
+                   const std::size_t size, const wgpu::TexelCopyBufferLayout& layout, const wgpu::Extent3D& extent) {
+  queue.WriteTexture(&destination, data, size, &layout, &extent);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_write_texture(destination, data, size, layout, extent);
+  }
+}
+
+wgpu::BindGroup create_bind_group(const wgpu::Device& device, const wgpu::BindGroupDescriptor& descriptor) {
+  wgpu::BindGroup bind_group = device.CreateBindGroup(&descriptor);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_bind_group(bind_group, descriptor);
+  }
+  return bind_group;
+}
+
+void traced_bundle_encoder::set_pipeline(const wgpu::RenderPipeline& pipeline) const {
+  encoder_.SetPipeline(pipeline);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_set_pipeline(pipeline);
+  }
+}
+
+void traced_bundle_encoder::set_bind_group(const std::uint32_t group, const wgpu::BindGroup& bind_group) const {
+  encoder_.SetBindGroup(group, bind_group, 0, nullptr);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_set_bind_group(group, bind_group);
+  }
+}
+
+void traced_bundle_encoder::set_vertex_buffer(const std::uint32_t slot, const wgpu::Buffer& buffer,
+                                              const std::uint64_t offset, const std::uint64_t size) const {
+  encoder_.SetVertexBuffer(slot, buffer, offset, size);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_set_vertex_buffer(slot, buffer, offset, size);
+  }
+}
+
+void traced_bundle_encoder::set_index_buffer(const wgpu::Buffer& buffer, const wgpu::IndexFormat format,
+                                             const std::uint64_t offset, const std::uint64_t size) const {
+  encoder_.SetIndexBuffer(buffer, format, offset, size);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_set_index_buffer(buffer, format, offset, size);
+  }
+}
+
+void traced_bundle_encoder::draw(const std::uint32_t vertex_count, const std::uint32_t instance_count,
+                                 const std::uint32_t first_vertex, const std::uint32_t first_instance) const {
+  encoder_.Draw(vertex_count, instance_count, first_vertex, first_instance);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_draw(vertex_count, instance_count, first_vertex, first_instance);
+  }
+}
+
+void traced_bundle_encoder::draw_indexed(const std::uint32_t index_count, const std::uint32_t instance_count,
+                                         const std::uint32_t first_index, const std::int32_t base_vertex,
+                                         const std::uint32_t first_instance) const {
+  encoder_.DrawIndexed(index_count, instance_count, first_index, base_vertex, first_instance);
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_draw_indexed(index_count, instance_count, first_index, base_vertex, first_instance);
+  }
+}
+
+wgpu::RenderBundle traced_bundle_encoder::finish() const {
+  wgpu::RenderBundleDescriptor descriptor{};
+  return encoder_.Finish(&descriptor);
+}
+
+std::optional<capture_replayer> capture_replayer::open(const std::string& path) {
+  auto file = std::make_unique<QFile>(QString::fromStdString(path));
+  if (!file->open(QIODevice::ReadOnly)) {
+    fmt::print("Failed to open capture file: {} ({})\n", path, file->errorString().toStdString());
+    return std::nullopt;
+  }
+  if (file->size() < static_cast<qint64>(sizeof(capture_file_header))) {
+    fmt::print("Capture file is too small to contain a header: {}\n", path);
+    return std::nullopt;
+  }
+  const uchar* const mapped = file->map(0, file->size());
+  if (!mapped) {
+    fmt::print("Failed to map capture file: {} ({})\n", path, file->errorString().toStdString());
+    return std::nullopt;
+  }
+  capture_file_header header{};
+  std::memcpy(&header, mapped, sizeof(header));
+  if (header.magic != capture_magic || header.version != capture_version) {
+    fmt::print("Not a capture file, or unsupported version: {}\n", path);
+    return std::nullopt;
+  }
+  if (!magic_enum::enum_contains(header.profile)) {
+    fmt::print("Capture file has an unknown device profile: {}\n", path);
+    return std::nullopt;
+  }
+
+  capture_replayer replayer{};
+  replayer.data_ = std::span<const std::byte>(reinterpret_cast<const std::byte*>(mapped),
+                                              static_cast<std::size_t>(file->size()))
+                       .subspan(sizeof(capture_file_header));
+  replayer.file_ = std::move(file);
+  replayer.profile_ = header.profile;
+  return replayer;
+}
+
+capture_replayer::capture_replayer(capture_replayer&&) noexcept = default;
+capture_replayer& capture_replayer::operator=(capture_replayer&&) noexcept = default;
+capture_replayer::~capture_replayer() = default;
+
+// Copy a payload struct out of a record. Records are packed, so the payload may be misaligned.
+template <typename T>
+static bool read_payload(const std::span<const std::byte> record, T& out) {
+  if (record.size() < sizeof(T)) {
+    fmt::print("Truncated capture record\n");
+    return false;
+  }
+  std::memcpy(&out, record.data(), sizeof(T));
+  return true;
+}
+
+// Block until all work submitted to the queue so far has completed.
+static void wait_for_queue(const wgpu::Device& device) {
+  bool done = false;
+  device.GetQueue().OnSubmittedWorkDone(wgpu::CallbackMode::AllowSpontaneous,
+                                        [&](wgpu::QueueWorkDoneStatus, wgpu::StringView) { done = true; });
+  while (!done) {
+    device.Tick();
+  }
+}
+
+namespace {
+
+// Objects re-created from a trace, by capture id.
+struct replay_state {
+  std::unordered_map<capture_id, wgpu::Buffer> buffers{};
+  std::unordered_map<capture_id, wgpu::Texture> textures{};
+  std::unordered_map<capture_id, wgpu::RenderPipeline> pipelines{};
+  std::unordered_map<capture_id, wgpu::BindGroupLayout> layouts{};
+  std::unordered_map<capture_id, wgpu::BindGroup> bind_groups{};
+  std::optional<mip_generator> mips{};
+  wgpu::Sampler trilinear_sampler{};
+  wgpu::ShaderModule toy_shader{};
+  std::uint64_t missing_objects{0};
+
+  const wgpu::Sampler& sampler(const wgpu::Device& device) {
+    if (!trilinear_sampler) {
+      trilinear_sampler = create_trilinear_sampler(device);
+    }
+    return trilinear_sampler;
+  }
+
+  template <typename T>
+  T find(const std::unordered_map<capture_id, T>& objects, const capture_id id) {
+    const auto it = objects.find(id);
+    if (it == objects.end()) {
+      ++missing_objects;
+      return T{};
+    }
+    return it->second;
+  }
+};
+
+// Offscreen stand-ins for the surface, MSAA and depth textures.
+struct replay_targets {
+  capture_begin_frame frame{};
+  wgpu::Texture color{};
+  wgpu::Texture msaa{};
+  wgpu::Texture depth{};
+
+  void update(const wgpu::Device& device, const capture_begin_frame& next) {
+    if (color && next.width == frame.width && next.height == frame.height && next.format == frame.format &&
+        next.sample_count == frame.sample_count) {
+      return;
+    }
+    frame = next;
+    wgpu::TextureDescriptor descriptor{};
+    descriptor.label = "Replay color target";
+    descriptor.size = wgpu::Extent3D{std::max(frame.width, 1u), std::max(frame.height, 1u), 1};
+    descriptor.format = frame.format;
+    descriptor.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+    color = device.CreateTexture(&descriptor);
+    msaa = frame.sample_count > 1
+               ? create_multisample_texure(device, frame.format, frame.width, frame.height, frame.sample_count)
+               : wgpu::Texture{};
+    depth = create_depth_texture(device, frame.width, frame.height, frame.sample_count);
+  }
+};
+
+// Resolves a pair of timestamps around the render pass into a mappable buffer.
+struct replay_timestamps {
+  wgpu::QuerySet query_set{};
+  wgpu::Buffer resolve_buffer{};
+  wgpu::Buffer readback_buffer{};
+
+  explicit replay_timestamps(const wgpu::Device& device) {
+    if (!device.HasFeature(wgpu::FeatureName::TimestampQuery)) {
+      fmt::print("Device has no timestamp queries, GPU times will not be reported.\n");
+      return;
+    }
+    wgpu::QuerySetDescriptor query_descriptor{};
+    query_descriptor.label = "Replay timestamps";
+    query_descriptor.type = wgpu::QueryType::Timestamp;
+    query_descriptor.count = 2;
+    query_set = device.CreateQuerySet(&query_descriptor);
+
+    wgpu::BufferDescriptor descriptor{};
+    descriptor.size = 2 * sizeof(std::uint64_t);
+    descriptor.label = "Replay timestamp resolve buffer";
+    descriptor.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+    resolve_buffer = device.CreateBuffer(&descriptor);
+    descriptor.label = "Replay timestamp readback buffer";
+    descriptor.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+    readback_buffer = device.CreateBuffer(&descriptor);
+  }
+
+  // Read back the timestamps of a completed frame.
+  std::optional<std::chrono::microseconds> read(const wgpu::Device& device) const {
+    if (!query_set) {
+      return std::nullopt;
+    }
+    bool done = false;
+    bool mapped = false;
+    readback_buffer.MapAsync(wgpu::MapMode::Read, 0, 2 * sizeof(std::uint64_t), wgpu::CallbackMode::AllowSpontaneous,
+                             [&](wgpu::MapAsyncStatus status, wgpu::StringView) {
+                               mapped = status == wgpu::MapAsyncStatus::Success;
+                               done = true;
+                             });
+    while (!done) {
+      device.Tick();
+    }
+    if (!mapped) {
+      return std::nullopt;
+    }
+    std::uint64_t ticks[2]{};
+    std::memcpy(ticks, readback_buffer.GetConstMappedRange(0, sizeof(ticks)), sizeof(ticks));
+    readback_buffer.Unmap();
+    // Timestamps are in nanoseconds. They can go backwards if the GPU changes clock rate mid-pass.
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::nanoseconds(ticks[1] > ticks[0] ? ticks[1] - ticks[0] : 0));
+  }
+};
+
+}  // namespace
+
+std::vector<replay_frame_timing> capture_replayer::replay(const wgpu::Device& device) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  const wgpu::Queue queue = device.GetQueue();
+
+  replay_state state{};
+  replay_targets targets{};
+  const replay_timestamps timestamps{device};
+  std::vector<replay_frame_timing> timings{};
+
+  wgpu::RenderBundleEncoder bundle_encoder{};
+  std::optional<std::chrono::steady_clock::time_point> frame_start{};
+
+  std::span<const std::byte> remaining = data_;
+  while (!remaining.empty()) {
+    capture_record_header header{};
+    if (!read_payload(remaining, header) || remaining.size() - sizeof(header) < header.size) {
+      fmt::print("Capture ends with a truncated record\n");
+      break;
+    }
+    const std::span<const std::byte> record = remaining.subspan(sizeof(header), header.size);
+    remaining = remaining.subspan(sizeof(header) + header.size);
+
+    // Everything since the previous frame was submitted counts towards this frame's CPU time.
+    if (!frame_start) {
+      frame_start = std::chrono::steady_clock::now();
+    }
+
+    switch (header.op) {
+      case capture_op::create_buffer: {
+        capture_create_buffer payload{};
+        if (read_payload(record, payload)) {
+          // Buffers that were mapped at creation are filled by a recorded write instead.
+          wgpu::BufferDescriptor descriptor{};
+          descriptor.size = payload.size;
+          descriptor.usage = static_cast<wgpu::BufferUsage>(payload.usage) | wgpu::BufferUsage::CopyDst;
+          state.buffers[payload.id] = device.CreateBuffer(&descriptor);
+        }
+        break;
+      }
+      case capture_op::write_buffer: {
+        capture_write_buffer payload{};
+        if (read_payload(record, payload)) {
+          const wgpu::Buffer buffer = state.find(state.buffers, payload.buffer);
+          const auto data = record.subspan(sizeof(payload));
+          const std::uint64_t aligned_size = data.size() & ~3ull;
+          if (buffer && aligned_size > 0) {
+            queue.WriteBuffer(buffer, payload.offset, data.data(), aligned_size);
+          }
+          if (buffer && aligned_size < data.size()) {
+            std::array<std::byte, 4> tail{};
+            std::memcpy(tail.data(), data.data() + aligned_size, data.size() - aligned_size);
+            queue.WriteBuffer(buffer, payload.offset + aligned_size, tail.data(), tail.size());
+          }
+        }
+        break;
+      }
+      case capture_op::create_texture: {
+        capture_create_texture payload{};
+        if (read_payload(record, payload)) {
+          wgpu::TextureDescriptor descriptor{};
+          descriptor.format = payload.format;
+          descriptor.dimension = payload.dimension;
+          descriptor.size = wgpu::Extent3D{payload.width, payload.height, payload.depth_or_array_layers};
+          descriptor.mipLevelCount = payload.mip_level_count;
+          descriptor.sampleCount = payload.sample_count;
+          descriptor.usage = static_cast<wgpu::TextureUsage>(payload.usage) | wgpu::TextureUsage::CopyDst;
+          state.textures[payload.id] = device.CreateTexture(&descriptor);
+        }
+        break;
+      }
+      case capture_op::write_texture: {
+        capture_write_texture payload{};
+        if (read_payload(record, payload)) {
+          const auto data = record.subspan(sizeof(payload));
+          wgpu::TexelCopyTextureInfo destination{};
+          destination.texture = state.find(state.textures, payload.texture);
+          destination.mipLevel = payload.mip_level;
+          destination.origin = wgpu::Origin3D{payload.origin[0], payload.origin[1], payload.origin[2]};
+          wgpu::TexelCopyBufferLayout layout{};
+          layout.bytesPerRow = payload.bytes_per_row;
+          layout.rowsPerImage = payload.rows_per_image;
+          const wgpu::Extent3D extent{payload.size[0], payload.size[1], payload.size[2]};
+          if (destination.texture) {
+            queue.WriteTexture(&destination, data.data(), data.size(), &layout, &extent);
+          }
+        }
+        break;
+      }
+      case capture_op::create_pipeline: {
+        capture_create_pipeline payload{};
+        if (!read_payload(record, payload)) {
+          break;
+        }
+        const capture_pipeline_params& params = payload.params;
+        wgpu::RenderPipeline pipeline{};
+        wgpu::BindGroupLayout layout{};
+        switch (params.kind) {
+          case capture_pipeline_kind::toy:
+            if (!state.toy_shader) {
+              state.toy_shader = make_toy_shader_module(device);
+            }
+            std::tie(pipeline, layout) = make_toy_render_pipeline(
+                device, state.toy_shader, make_toy_pipeline_key(params.format, params.sample_count, params.switches));
+            break;
+          case capture_pipeline_kind::mesh: {
+            mesh_file_header mesh_header{};
+            mesh_header.attributes = params.mesh_attributes;
+            mesh_header.vertex_stride = mesh_vertex_stride(params.mesh_attributes);
+            mesh_header.topology = static_cast<mesh_topology>(params.mesh_topology);
+            std::tie(pipeline, layout) =
+                make_mesh_render_pipeline(device, params.format, params.sample_count, mesh_header);
+            break;
+          }
+          case capture_pipeline_kind::plot_line:
+          case capture_pipeline_kind::plot_point: {
+            // The plot pipelines share a layout, which was created separately.
+            const auto it = state.layouts.find(payload.layout);
+            layout = it != state.layouts.end() ? it->second : make_plot_bind_group_layout(device);
+            pipeline = make_plot_render_pipeline(device, layout, params.format, params.sample_count,
+                                                 params.kind == capture_pipeline_kind::plot_line
+                                                     ? wgpu::PrimitiveTopology::LineStrip
+                                                     : wgpu::PrimitiveTopology::PointList);
+            break;
+          }
+          case capture_pipeline_kind::overlay:
+            std::tie(pipeline, layout) = make_overlay_render_pipeline(device, params.format, params.sample_count);
+            break;
+        }
+        state.pipelines[payload.id] = pipeline;
+        state.layouts[payload.layout] = layout;
+        break;
+      }
+      case capture_op::create_bind_group: {
+        capture_create_bind_group payload{};
+        if (!read_payload(record, payload) ||
+            record.size() < sizeof(payload) + payload.entry_count * sizeof(capture_bind_group_entry)) {
+          break;
+        }
+        std::vector<capture_bind_group_entry> recorded(payload.entry_count);
+        std::memcpy(recorded.data(), record.data() + sizeof(payload),
+                    recorded.size() * sizeof(capture_bind_group_entry));
+        std::vector<wgpu::BindGroupEntry> entries(recorded.size());
+        for (std::size_t i = 0; i < recorded.size(); ++i) {
+          entries[i].binding = recorded[i].binding;
+          if (recorded[i].sampler != 0) {
+            entries[i].sampler = state.sampler(device);
+          } else if (recorded[i].texture != 0) {
+            const wgpu::Texture texture = state.find(state.textures, recorded[i].texture);
+            entries[i].textureView = texture ? texture.CreateView() : wgpu::TextureView{};
+          } else {
+            entries[i].buffer = state.find(state.buffers, recorded[i].buffer);
+            entries[i].offset = recorded[i].offset;
+            entries[i].size = recorded[i].size;
+          }
+        }
+        wgpu::BindGroupDescriptor descriptor{};
+        descriptor.layout = state.find(state.layouts, payload.layout);
+        descriptor.entryCount = entries.size();
+        descriptor.entries = entries.data();
+        state.bind_groups[payload.id] = device.CreateBindGroup(&descriptor);
+        break;
+      }
+      case capture_op::generate_mips: {
+        capture_generate_mips payload{};
+        if (read_payload(record, payload)) {
+          if (const wgpu::Texture texture = state.find(state.textures, payload.texture); texture) {
+            if (!state.mips) {
+              state.mips.emplace(device);
+            }
+            state.mips->generate({&texture, 1});
+          }
+        }
+        break;
+      }
+      case capture_op::begin_frame: {
+        capture_begin_frame payload{};
+        if (!read_payload(record, payload)) {
+          break;
+        }
+        targets.update(device, payload);
+        wgpu::RenderBundleEncoderDescriptor encoder_desc{};
+        encoder_desc.sampleCount = payload.sample_count;
+        encoder_desc.colorFormatCount = 1;
+        encoder_desc.colorFormats = &payload.format;
+        encoder_desc.label = "Replay bundle encoder";
+        encoder_desc.depthStencilFormat = wgpu::TextureFormat::Depth32Float;
+        bundle_encoder = device.CreateRenderBundleEncoder(&encoder_desc);
+        break;
+      }
+      case capture_op::set_pipeline: {
+        capture_set_pipeline payload{};
+        if (bundle_encoder && read_payload(record, payload)) {
+          bundle_encoder.SetPipeline(state.find(state.pipelines, payload.pipeline));
+        }
+        break;
+      }
+      case capture_op::set_bind_group: {
+        capture_set_bind_group payload{};
+        if (bundle_encoder && read_payload(record, payload)) {
+          bundle_encoder.SetBindGroup(payload.group, state.find(state.bind_groups, payload.bind_group), 0, nullptr);
+        }
+        break;
+      }
+      case capture_op::set_vertex_buffer: {
+        capture_set_vertex_buffer payload{};
+        if (bundle_encoder && read_payload(record, payload)) {
+          bundle_encoder.SetVertexBuffer(payload.slot, state.find(state.buffers, payload.buffer), payload.offset,
+                                         payload.size);
+        }
+        break;
+      }
+      case capture_op::set_index_buffer: {
+        capture_set_index_buffer payload{};
+        if (bundle_encoder && read_payload(record, payload)) {
+          bundle_encoder.SetIndexBuffer(state.find(state.buffers, payload.buffer), payload.format, payload.offset,
+                                        payload.size);
+        }
+        break;
+      }
+      case capture_op::draw: {
+        capture_draw payload{};
+        if (bundle_encoder && read_payload(record, payload)) {
+          bundle_encoder.Draw(payload.vertex_count, payload.instance_count, payload.first_vertex,
+                              payload.first_instance);
+        }
+        break;
+      }
+      case capture_op::draw_indexed: {
+        capture_draw_indexed payload{};
+        if (bundle_encoder && read_payload(record, payload)) {
+          bundle_encoder.DrawIndexed(payload.index_count, payload.instance_count, payload.first_index,
+                                     payload.base_vertex, payload.first_instance);
+        }
+        break;
+      }
+      case capture_op::end_frame: {
+        if (!bundle_encoder) {
+          break;
+        }
+        wgpu::RenderBundleDescriptor bundle_desc{};
+        const wgpu::RenderBundle bundle = bundle_encoder.Finish(&bundle_desc);
+        bundle_encoder = nullptr;
+
+        wgpu::RenderPassColorAttachment color_attachment{};
+        color_attachment.view = targets.msaa ? targets.msaa.CreateView() : targets.color.CreateView();
+        color_attachment.resolveTarget = targets.msaa ? targets.color.CreateView() : wgpu::TextureView{};
+        color_attachment.loadOp = wgpu::LoadOp::Clear;
+        color_attachment.storeOp = wgpu::StoreOp::Store;
+        color_attachment.clearValue = wgpu::Color{0.235, 0.235, 0.235, 1.0};
+        color_attachment.depthSlice = wgpu::kDepthSliceUndefined;
+
+        wgpu::RenderPassDepthStencilAttachment depth_attachment{};
+        depth_attachment.view = targets.depth.CreateView();
+        depth_attachment.depthLoadOp = wgpu::LoadOp::Clear;
+        depth_attachment.depthStoreOp = wgpu::StoreOp::Store;
+        depth_attachment.depthClearValue = 1.0f;
+
+        wgpu::PassTimestampWrites timestamp_writes{};
+        timestamp_writes.querySet = timestamps.query_set;
+        timestamp_writes.beginningOfPassWriteIndex = 0;
+        timestamp_writes.endOfPassWriteIndex = 1;
+
+        wgpu::RenderPassDescriptor pass_desc{};
+        pass_desc.label = "Replay render pass";
+        pass_desc.colorAttachmentCount = 1;
+        pass_desc.colorAttachments = &color_attachment;
+        pass_desc.depthStencilAttachment = &depth_attachment;
+        pass_desc.timestampWrites = timestamps.query_set ? &timestamp_writes : nullptr;
+
+        const wgpu::CommandEncoder command_encoder = device.CreateCommandEncoder();
+        const wgpu::RenderPassEncoder pass = command_encoder.BeginRenderPass(&pass_desc);
+        pass.ExecuteBundles(1, &bundle);
+        pass.End();
+        if (timestamps.query_set) {
+          command_encoder.ResolveQuerySet(timestamps.query_set, 0, 2, timestamps.resolve_buffer, 0);
+          command_encoder.CopyBufferToBuffer(timestamps.resolve_buffer, 0, timestamps.readback_buffer, 0,
+                                             2 * sizeof(std::uint64_t));
+        }
+        const wgpu::CommandBuffer command = command_encoder.Finish();
+        queue.Submit(1, &command);
+
+        replay_frame_timing timing{};
+        const auto submit_time = std::chrono::steady_clock::now();
+        timing.cpu = std::chrono::duration_cast<std::chrono::microseconds>(submit_time - *frame_start);
+        wait_for_queue(device);
+        timing.submit_to_done =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - submit_time);
+        timing.gpu = timestamps.read(device);
+        timings.push_back(timing);
+        frame_start.reset();
+        break;
+      }
+      default:
+        fmt::print("Skipping unknown capture record: {}\n", static_cast<std::uint32_t>(header.op));
+        break;
+    }
+  }
+
+  if (state.missing_objects > 0) {
+    fmt::print("Warning: {} commands referred to objects missing from the capture. Was it started after the "
+               "device was created?\n",
+               state.missing_objects);
+  }
+  return timings;
+}
+
+}  // namespace wgpu_utils
@@ -0,0 +1,331 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+#include "wgpu_setup.hpp"
+
+class QFile;
+
+namespace wgpu_utils {
+
+// A trace is a short file header followed by records: [capture_record_header][payload struct][trailing data].
+// Payload structs are written as-is (little-endian, no pointers), so a trace only replays on the same ABI.
+constexpr std::array<char, 4> capture_magic{'Q', 'W', 'T', 'R'};
+constexpr std::uint32_t capture_version = 4;
+
+enum class capture_op : std::uint32_t {
+  create_buffer,
+  write_buffer,
+  create_texture,
+  write_texture,
+  create_pipeline,
+  create_bind_group,
+  begin_frame,
+  set_pipeline,
+  set_bind_group,
+  set_vertex_buffer,
+  set_index_buffer,
+  draw,
+  draw_indexed,
+  end_frame,
+  generate_mips,
+};
+
+// Objects are referred to by sequential ids. Zero is an object created while no capture was active.
+using capture_id = std::uint32_t;
+
+struct capture_file_header {
+  std::array<char, 4> magic{capture_magic};
+  std::uint32_t version{capture_version};
+  // Profile of the device the trace was recorded on. The replayer uses it by default.
+  device_profile_kind profile{device_profile_kind::debug};
+};
+
+struct capture_record_header {
+  capture_op op;
+  std::uint32_t reserved{0};
+  // Size of the payload struct plus trailing data.
+  std::uint64_t size;
+};
+
+// Pipelines are not serialized as descriptors. Instead we record which factory made them, and with what arguments,
+// and the replayer calls the same factory.
+enum class capture_pipeline_kind : std::uint32_t { toy, mesh, plot_line, plot_point, overlay };
+
+struct capture_pipeline_params {
+  capture_pipeline_kind kind{capture_pipeline_kind::toy};
+  wgpu::TextureFormat format{wgpu::TextureFormat::Undefined};
+  std::uint32_t sample_count{1};
+  // Only used by `capture_pipeline_kind::mesh`: `mesh_attribute` mask and `mesh_topology`.
+  std::uint32_t mesh_attributes{0};
+  std::uint32_t mesh_topology{0};
+  // Only used by `capture_pipeline_kind::toy`: `toy_pipeline_switches` of the variant.
+  std::uint32_t switches{0};
+};
+
+struct capture_create_buffer {
+  capture_id id;
+  std::uint32_t reserved{0};
+  std::uint64_t size;
+  std::uint64_t usage;
+};
+
+// Followed by the data.
+struct capture_write_buffer {
+  capture_id buffer;
+  std::uint32_t reserved{0};
+  std::uint64_t offset;
+};
+
+struct capture_create_texture {
+  capture_id id;
+  wgpu::TextureFormat format;
+  wgpu::TextureDimension dimension;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t depth_or_array_layers;
+  std::uint32_t mip_level_count;
+  std::uint32_t sample_count;
+  std::uint64_t usage;
+};
+
+// Followed by the data, with `bytes_per_row` and `rows_per_image` describing its layout.
+struct capture_write_texture {
+  capture_id texture;
+  std::uint32_t mip_level;
+  std::uint32_t origin[3];
+  std::uint32_t size[3];
+  std::uint32_t bytes_per_row;
+  std::uint32_t rows_per_image;
+};
+
+struct capture_create_pipeline {
+  capture_id id;
+  // Bind group 0 of the pipeline, which bind groups refer to.
+  capture_id layout;
+  capture_pipeline_params params;
+};
+
+// Followed by `entry_count` x `capture_bind_group_entry`.
+struct capture_create_bind_group {
+  capture_id id;
+  capture_id layout;
+  std::uint32_t entry_count;
+  std::uint32_t reserved{0};
+};
+
+// A buffer range, a default view of a whole texture, or a sampler. Samplers aren't recorded: all of ours repeat, with
+// linear filtering between texels and mip levels, and the replayer binds one like that.
+struct capture_bind_group_entry {
+  std::uint32_t binding;
+  capture_id buffer;
+  capture_id texture;
+  std::uint32_t sampler{0};
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+// Levels 1 and up of the texture were filled from level 0 by `mip_generator`.
+struct capture_generate_mips {
+  capture_id texture;
+};
+
+struct capture_begin_frame {
+  std::uint32_t width;
+  std::uint32_t height;
+  wgpu::TextureFormat format;
+  std::uint32_t sample_count;
+};
+
+struct capture_set_pipeline {
+  capture_id pipeline;
+};
+
+struct capture_set_bind_group {
+  std::uint32_t group;
+  capture_id bind_group;
+};
+
+struct capture_set_vertex_buffer {
+  std::uint32_t slot;
+  capture_id buffer;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+struct capture_set_index_buffer {
+  capture_id buffer;
+  wgpu::IndexFormat format;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+struct capture_draw {
+  std::uint32_t vertex_count;
+  std::uint32_t instance_count;
+  std::uint32_t first_vertex;
+  std::uint32_t first_instance;
+};
+
+struct capture_draw_indexed {
+  std::uint32_t index_count;
+  std::uint32_t instance_count;
+  std::uint32_t first_index;
+  std::int32_t base_vertex;
+  std::uint32_t first_instance;
+};
+
+// Records resource creation, queue writes and the contents of each frame's render bundle to a trace file.
+//
+// Not thread safe: record from the thread that owns the device.
+class capture_writer {
+ public:
+  // Returns nullptr (and prints the reason) if `path` can't be opened for writing. `profile` is the profile of the
+  // device being recorded.
+  static std::unique_ptr<capture_writer> open(const std::string& path, device_profile_kind profile);
+
+  ~capture_writer();
+
+  void record_buffer(const wgpu::Buffer& buffer, const wgpu::BufferDescriptor& descriptor);
+  void record_write_buffer(const wgpu::Buffer& buffer, std::uint64_t offset, const void* data, std::size_t size);
+  void record_texture(const wgpu::Texture& texture, const wgpu::TextureDescriptor& descriptor);
+  // Views are recorded as default views of their texture.
+  void record_texture_view(const wgpu::TextureView& view, const wgpu::Texture& texture);
+  void record_write_texture(const wgpu::TexelCopyTextureInfo& destination, const void* data, std::size_t size,
+                            const wgpu::TexelCopyBufferLayout& layout, const wgpu::Extent3D& extent);
+  void record_pipeline(const wgpu::RenderPipeline& pipeline, const wgpu::BindGroupLayout& layout,
+                       const capture_pipeline_params& params);
+  void record_bind_group(const wgpu::BindGroup& bind_group, const wgpu::BindGroupDescriptor& descriptor);
+  void record_generate_mips(const wgpu::Texture& texture);
+
+  // Bracket the commands encoded for one frame. The replayer renders into offscreen targets matching these.
+  void begin_frame(std::uint32_t width, std::uint32_t height, wgpu::TextureFormat format, std::uint32_t sample_count);
+  void end_frame();
+
+  void record_set_pipeline(const wgpu::RenderPipeline& pipeline);
+  void record_set_bind_group(std::uint32_t group, const wgpu::BindGroup& bind_group);
+  void record_set_vertex_buffer(std::uint32_t slot, const wgpu::Buffer& buffer, std::uint64_t offset,
+                                std::uint64_t size);
+  void record_set_index_buffer(const wgpu::Buffer& buffer, wgpu::IndexFormat format, std::uint64_t offset,
+                               std::uint64_t size);
+  void record_draw(std::uint32_t vertex_count, std::uint32_t instance_count, std::uint32_t first_vertex,
+                   std::uint32_t first_instance);
+  void record_draw_indexed(std::uint32_t index_count, std::uint32_t instance_count, std::uint32_t first_index,
+                           std::int32_t base_vertex, std::uint32_t first_instance);
+
+  constexpr std::uint64_t frame_count() const noexcept { return frame_count_; }
+  std::uint64_t bytes_written() const;
+
+  // True once a write has failed. The error is printed then, and nothing more is recorded: the trace is truncated.
+  constexpr bool failed() const noexcept { return failed_; }
+
+  // Flush buffered records to disk. Returns false if this or any earlier write failed.
+  bool flush();
+
+ private:
+  explicit capture_writer(std::unique_ptr<QFile> file);
+
+  // Give `handle` a new id. Handles are raw pointers, which dawn may reuse once an object is released.
+  capture_id assign_id(const void* handle);
+  capture_id find_id(const void* handle) const;
+
+  // Write a record header and its payload struct. The caller then writes `data_size` bytes of trailing data.
+  void write_record(capture_op op, const void* payload, std::size_t payload_size, std::uint64_t data_size = 0);
+  void write_data(const void* data, std::uint64_t size);
+  void write_bytes(const void* data, std::uint64_t size);
+
+  std::unique_ptr<QFile> file_;
+  capture_id next_id_{1};
+  std::unordered_map<const void*, capture_id> ids_{};
+  std::unordered_map<const void*, capture_id> view_textures_{};
+  std::uint64_t frame_count_{0};
+  bool in_frame_{false};
+  bool failed_{false};
+};
+
+// The capture that the helpers below record into, or nullptr when not capturing.
+capture_writer* active_capture() noexcept;
+void set_active_capture(capture_writer* capture) noexcept;
+
+// Drop-in replacements for the wgpu calls we trace. They behave exactly like the wrapped call, and additionally
+// record into the active capture if there is one.
+wgpu::Buffer create_buffer(const wgpu::Device& device, const wgpu::BufferDescriptor& descriptor);
+void write_buffer(const wgpu::Queue& queue, const wgpu::Buffer& buffer, std::uint64_t offset, const void* data,
+                  std::size_t size);
+wgpu::Texture create_texture(const wgpu::Device& device, const wgpu::TextureDescriptor& descriptor);
+wgpu::TextureView create_texture_view(const wgpu::Texture& texture);
+void write_texture(const wgpu::Queue& queue, const wgpu::TexelCopyTextureInfo& destination, const void* data,
+                   std::size_t size, const wgpu::TexelCopyBufferLayout& layout, const wgpu::Extent3D& extent);
+wgpu::BindGroup create_bind_group(const wgpu::Device& device, const wgpu::BindGroupDescriptor& descriptor);
+
+// Records commands into a render bundle, and into the active capture.
+class traced_bundle_encoder {
+ public:
+  explicit traced_bundle_encoder(wgpu::RenderBundleEncoder encoder) : encoder_(std::move(encoder)) {}
+
+  void set_pipeline(const wgpu::RenderPipeline& pipeline) const;
+  void set_bind_group(std::uint32_t group, const wgpu::BindGroup& bind_group) const;
+  void set_vertex_buffer(std::uint32_t slot, const wgpu::Buffer& buffer, std::uint64_t offset,
+                         std::uint64_t size) const;
+  void set_index_buffer(const wgpu::Buffer& buffer, wgpu::IndexFormat format, std::uint64_t offset,
+                        std::uint64_t size) const;
+  void draw(std::uint32_t vertex_count, std::uint32_t instance_count = 1, std::uint32_t first_vertex = 0,
+            std::uint32_t first_instance = 0) const;
+  void draw_indexed(std::uint32_t index_count, std::uint32_t instance_count = 1, std::uint32_t first_index = 0,
+                    std::int32_t base_vertex = 0, std::uint32_t first_instance = 0) const;
+
+  wgpu::RenderBundle finish() const;
+
+  constexpr const wgpu::RenderBundleEncoder& get() const noexcept { return encoder_; }
+
+ private:
+  wgpu::RenderBundleEncoder encoder_;
+};
+
+// Timings for one replayed frame.
+struct replay_frame_timing {
+  // Time to create resources, write data, encode and submit the frame.
+  std::chrono::microseconds cpu{0};
+  // Render pass duration from timestamp queries, if the device supports them.
+  std::optional<std::chrono::microseconds> gpu{};
+  // Wall time from submit until `OnSubmittedWorkDone` fired.
+  std::chrono::microseconds submit_to_done{0};
+};
+
+// Re-executes a trace against a device, rendering each frame to offscreen targets. Frames are replayed one at a time:
+// we wait for each to complete before starting the next, so the timings of one frame don't overlap the next.
+class capture_replayer {
+ public:
+  // Map the trace at `path` and check its header. Returns nullopt (and prints the reason) on failure.
+  static std::optional<capture_replayer> open(const std::string& path);
+
+  capture_replayer(capture_replayer&&) noexcept;
+  capture_replayer& operator=(capture_replayer&&) noexcept;
+  ~capture_replayer();
+
+  // Replay the whole trace, returning the timings of each frame.
+  std::vector<replay_frame_timing> replay(const wgpu::Device& device);
+
+  // Profile of the device the trace was recorded on.
+  constexpr device_profile_kind profile() const noexcept { return profile_; }
+
+ private:
+  capture_replayer() = default;
+
+  std::unique_ptr<QFile> file_;
+  std::span<const std::byte> data_{};
+  device_profile_kind profile_{device_profile_kind::debug};
+};
+
+}  // namespace wgpu_utils
@@ -9,15 +9,16 @@
 
 namespace wgpu_utils {
 
-wgpu_context::wgpu_context(wgpu::Instance instance, wgpu::Surface surface) : surface_(surface) {
+wgpu_context::wgpu_context(wgpu::Instance instance, wgpu::Surface surface, const device_profile& profile)
+    : surface_(surface) {
   Q_ASSERT(instance);
 
-  adapter_ = wgpu_utils::request_adapter(instance);
+  adapter_ = wgpu_utils::request_adapter(instance, profile);
   Q_ASSERT(adapter_);
   enumerate_adapter_properties(adapter_);
   enumerate_adapter_features(adapter_);
 
-  device_ = wgpu_utils::request_device(adapter_);
+  device_ = wgpu_utils::request_device(adapter_, profile);
   Q_ASSERT(device_);
   enumerate_device_limits(device_);
 
@@ -32,17 +33,19 @@ wgpu_context::wgpu_context(wgpu::Instance instance, wgpu::Surface surface) : sur
     }
     Q_ASSERT(!supported_formats.empty());
     surface_format_ = supported_formats.front();
+    surface_usages_ = capabilities.usages;
   }
 }
 
-void wgpu_context::configure_surface(std::uint32_t width, std::uint32_t height) {
+void wgpu_context::configure_surface(std::uint32_t width, std::uint32_t height, const wgpu::TextureUsage extra_usage) {
   Q_ASSERT(surface_);
+  Q_ASSERT((surface_usages_ & extra_usage) == extra_usage);
   WGPU_ERROR_FUNCTION_SCOPE(device_);
 
   wgpu::SurfaceConfiguration config{};
   config.width = width;
   config.height = height;
-  config.usage = wgpu::TextureUsage::RenderAttachment;
+  config.usage = wgpu::TextureUsage::RenderAttachment | extra_usage;
   config.format = surface_format_.value();
   config.device = device_;
   config.presentMode = wgpu::PresentMode::Fifo;
@@ -1,25 +1,33 @@
 #pragma once
 #include <webgpu/webgpu_cpp.h>
 
+#include "wgpu_setup.hpp"
+
 namespace wgpu_utils {
 
 // Store the device and information about the render surface.
 class wgpu_context {
  public:
-  explicit wgpu_context(wgpu::Instance instance, wgpu::Surface surface);
+  explicit wgpu_context(wgpu::Instance instance, wgpu::Surface surface, const device_profile& profile);
 
   constexpr const auto& surface() const noexcept { return surface_; }
   constexpr const auto& device() const noexcept { return device_; }
 
   constexpr std::optional<wgpu::TextureFormat> surface_format() const noexcept { return surface_format_; }
 
-  void configure_surface(std::uint32_t width, std::uint32_t height);
+  // Usages the surface textures support, as reported by the surface capabilities. Includes `RenderAttachment`.
+  constexpr wgpu::TextureUsage surface_usages() const noexcept { return surface_usages_; }
+
+  // `extra_usage` is added to `RenderAttachment`, and must be a subset of `surface_usages()`.
+  void configure_surface(std::uint32_t width, std::uint32_t height,
+                         wgpu::TextureUsage extra_usage = wgpu::TextureUsage::None);
 
  private:
   wgpu::Adapter adapter_;
   wgpu::Device device_;
   wgpu::Surface surface_;
   std::optional<wgpu::TextureFormat> surface_format_;
+  wgpu::TextureUsage surface_usages_{wgpu::TextureUsage::None};
 };
 
 }  // namespace wgpu_utils
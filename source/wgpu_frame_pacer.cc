@@ -0,0 +1,82 @@
+#include "wgpu_frame_pacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "wgpu_fmt.hpp"
+
+namespace wgpu_utils {
+
+frame_pacer::frame_pacer(const std::uint32_t max_frames_in_flight, const frame_pacing_mode mode)
+    : max_frames_in_flight_(std::clamp(max_frames_in_flight, 1u, 3u)),
+      mode_(mode),
+      state_(std::make_shared<shared_state>()) {}
+
+bool frame_pacer::begin_frame(const wgpu::Device& device) {
+  // Give any completed frames a chance to report back first.
+  device.Tick();
+  if (submitted_serial_ - completed_serial() < max_frames_in_flight_) {
+    return true;
+  }
+  if (mode_ == frame_pacing_mode::skip) {
+    ++frames_skipped_;
+    return false;
+  }
+  while (submitted_serial_ - completed_serial() >= max_frames_in_flight_) {
+    std::this_thread::yield();
+    device.Tick();
+  }
+  return true;
+}
+
+std::uint64_t frame_pacer::end_frame(const wgpu::Queue& queue) {
+  const std::uint64_t serial = ++submitted_serial_;
+  const auto submit_time = std::chrono::steady_clock::now();
+  queue.OnSubmittedWorkDone(
+      wgpu::CallbackMode::AllowSpontaneous,
+      [state = state_, serial, submit_time](wgpu::QueueWorkDoneStatus status, wgpu::StringView message) {
+        // Count failed frames as complete too, otherwise a lost device would block forever.
+        if (status != wgpu::QueueWorkDoneStatus::Success) {
+          fmt::print("Frame {} did not complete [status = {}]: {}\n", serial, fmt_enum(status), message);
+        }
+        const auto latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - submit_time);
+        std::lock_guard<std::mutex> lock{state->mutex};
+        state->completed_serial = std::max(state->completed_serial, serial);
+        state->latencies[state->latency_count % history_size] = latency;
+        ++state->latency_count;
+      });
+  return serial;
+}
+
+std::uint32_t frame_pacer::poll(const wgpu::Device& device) {
+  device.Tick();
+  return static_cast<std::uint32_t>(submitted_serial_ - completed_serial());
+}
+
+std::uint64_t frame_pacer::completed_serial() const {
+  std::lock_guard<std::mutex> lock{state_->mutex};
+  return state_->completed_serial;
+}
+
+frame_latency_stats frame_pacer::stats() const {
+  frame_latency_stats stats{};
+  stats.frames_skipped = frames_skipped_;
+
+  std::lock_guard<std::mutex> lock{state_->mutex};
+  stats.frames_in_flight = static_cast<std::uint32_t>(submitted_serial_ - state_->completed_serial);
+  const std::size_t count = std::min<std::uint64_t>(state_->latency_count, history_size);
+  if (count == 0) {
+    return stats;
+  }
+  stats.last = state_->latencies[(state_->latency_count - 1) % history_size];
+  std::chrono::microseconds total{0};
+  for (std::size_t i = 0; i < count; ++i) {
+    total += state_->latencies[i];
+    stats.max = std::max(stats.max, state_->latencies[i]);
+  }
+  stats.mean = total / static_cast<std::int64_t>(count);
+  return stats;
+}
+
+}  // namespace wgpu_utils
@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+// What to do when the maximum number of frames is already in flight.
+enum class frame_pacing_mode {
+  // Tick the device until the oldest frame completes, then render.
+  block,
+  // Don't render this frame. Suits timer-driven loops where blocking would stall the event loop.
+  skip,
+};
+
+// CPU-submit to GPU-complete latency over recent frames.
+struct frame_latency_stats {
+  std::chrono::microseconds last{0};
+  std::chrono::microseconds mean{0};
+  std::chrono::microseconds max{0};
+  std::uint32_t frames_in_flight{0};
+  std::uint64_t frames_skipped{0};
+};
+
+// Bounds how far the CPU runs ahead of the GPU. Each submitted frame gets a serial, and registers
+// `Queue::OnSubmittedWorkDone` to find out when the GPU has finished with it.
+//
+// Latency is measured when the completion callback fires, which happens during `Device::Tick`. It is therefore only
+// as precise as the rate at which the device is ticked: callers should call `poll` at a short interval while
+// `frames_in_flight()` is non-zero, rather than relying on the tick once per frame.
+class frame_pacer {
+ public:
+  // `max_frames_in_flight` is clamped to [1, 3].
+  frame_pacer(std::uint32_t max_frames_in_flight, frame_pacing_mode mode);
+
+  // Call before encoding a frame. Returns false if the frame should be skipped.
+  bool begin_frame(const wgpu::Device& device);
+
+  // Call immediately after `Queue::Submit`. Returns the serial assigned to the frame.
+  std::uint64_t end_frame(const wgpu::Queue& queue);
+
+  // Tick the device, so completion callbacks fire and latency is timestamped close to when the GPU finished. Returns
+  // the number of frames still in flight.
+  std::uint32_t poll(const wgpu::Device& device);
+
+  // Serial of the newest frame the GPU has finished. Serials start at 1, so zero means none have completed.
+  std::uint64_t completed_serial() const;
+
+  constexpr std::uint64_t submitted_serial() const noexcept { return submitted_serial_; }
+  constexpr std::uint32_t max_frames_in_flight() const noexcept { return max_frames_in_flight_; }
+
+  frame_latency_stats stats() const;
+
+ private:
+  static constexpr std::size_t history_size = 64;
+
+  // Written from the completion callback, which may fire on another thread.
+  struct shared_state {
+    mutable std::mutex mutex;
+    std::uint64_t completed_serial{0};
+    std::array<std::chrono::microseconds, history_size> latencies{};
+    std::uint64_t latency_count{0};
+  };
+
+  std::uint32_t max_frames_in_flight_;
+  frame_pacing_mode mode_;
+  std::uint64_t submitted_serial_{0};
+  std::uint64_t frames_skipped_{0};
+  std::shared_ptr<shared_state> state_;
+};
+
+}  // namespace wgpu_utils
@@ -0,0 +1,262 @@
+#include "wgpu_input_latency.hpp"
+
+#include <qassert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "wgpu_error_scope.hpp"
+#include "wgpu_fmt.hpp"
+#include "wgpu_pipelines.hpp"
+
+namespace wgpu_utils {
+
+namespace {
+
+using std::chrono::microseconds;
+
+microseconds elapsed(const input_latency_tracker::clock::time_point from,
+                     const input_latency_tracker::clock::time_point to) {
+  return std::chrono::duration_cast<microseconds>(to - from);
+}
+
+latency_percentiles make_percentiles(std::vector<microseconds>& values) {
+  Q_ASSERT(!values.empty());
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&](const double p) {
+    return values[static_cast<std::size_t>(std::lround(p * static_cast<double>(values.size() - 1)))];
+  };
+  return latency_percentiles{percentile(0.5), percentile(0.95), percentile(0.99)};
+}
+
+// Red and blue are both full, so RGBA and BGRA targets store the same bytes.
+bool supports_marker(const wgpu::TextureFormat format) {
+  switch (format) {
+    case wgpu::TextureFormat::RGBA8Unorm:
+    case wgpu::TextureFormat::RGBA8UnormSrgb:
+    case wgpu::TextureFormat::BGRA8Unorm:
+    case wgpu::TextureFormat::BGRA8UnormSrgb:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Green channel byte of the marker for `tag`: 16 levels, 17 apart.
+std::uint8_t marker_level(const std::uint64_t tag) { return static_cast<std::uint8_t>((tag & 0xf) * 17); }
+
+// The blend constant that stores the marker bytes for `tag`. sRGB targets encode what is written, so the green
+// channel is decoded here to land on the intended byte.
+wgpu::Color marker_color(const std::uint64_t tag, const wgpu::TextureFormat format) {
+  double green = marker_level(tag) / 255.0;
+  if (format == wgpu::TextureFormat::RGBA8UnormSrgb || format == wgpu::TextureFormat::BGRA8UnormSrgb) {
+    green = green <= 0.04045 ? green / 12.92 : std::pow((green + 0.055) / 1.055, 2.4);
+  }
+  return wgpu::Color{1.0, green, 1.0, 1.0};
+}
+
+bool marker_matches(const std::array<std::uint8_t, 4>& texel, const std::uint64_t tag) {
+  return texel[0] == 255 && texel[2] == 255 && texel[3] == 255 &&
+         std::lround(texel[1] / 17.0) == static_cast<long>(tag & 0xf);
+}
+
+}  // namespace
+
+void input_latency_tracker::shared_state::complete_if_done(const std::uint64_t tag) {
+  const auto it = std::find_if(pending.begin(), pending.end(), [tag](const auto& frame) { return frame.tag == tag; });
+  if (it == pending.end() || !it->gpu_done || !it->presented) {
+    return;
+  }
+  // `Present` only queues the frame, so it can return before the GPU is done. The frame is shown after both.
+  samples[sample_count % history_size] = frame_sample{elapsed(it->input, it->submitted),
+                                                      elapsed(it->input, *it->gpu_done),
+                                                      elapsed(it->input, std::max(*it->presented, *it->gpu_done))};
+  ++sample_count;
+  pending.erase(it);
+}
+
+input_latency_tracker::input_latency_tracker() : state_(std::make_shared<shared_state>()) {}
+
+void input_latency_tracker::record_input(const clock::time_point time) {
+  if (!pending_input_ || time < *pending_input_) {
+    pending_input_ = time;
+  }
+}
+
+bool input_latency_tracker::begin_frame() {
+  frame_readback_.reset();
+  if (!pending_input_) {
+    frame_tag_ = 0;
+    return false;
+  }
+  frame_tag_ = next_tag_++;
+  frame_input_ = *pending_input_;
+  pending_input_.reset();
+  return true;
+}
+
+void input_latency_tracker::draw_marker(const wgpu::Device& device, const wgpu::RenderPassEncoder& pass,
+                                        const wgpu::TextureFormat format, const std::uint32_t sample_count,
+                                        const std::uint32_t width, const std::uint32_t height) {
+  if (!marker_enabled_ || frame_tag_ == 0) {
+    return;
+  }
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  if (!supports_marker(format)) {
+    fmt::print("Can't draw the latency marker in format {}\n", fmt_enum(format));
+    marker_enabled_ = false;
+    return;
+  }
+
+  std::optional<std::size_t> slot{};
+  {
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    const auto it = std::find(state_->readback_busy.begin(), state_->readback_busy.end(), false);
+    if (it == state_->readback_busy.end()) {
+      return;
+    }
+    *it = true;
+    slot = static_cast<std::size_t>(it - state_->readback_busy.begin());
+  }
+
+  if (!marker_pipeline_ || marker_format_ != format || marker_sample_count_ != sample_count) {
+    marker_pipeline_ = make_latency_marker_render_pipeline(device, format, sample_count);
+    marker_format_ = format;
+    marker_sample_count_ = sample_count;
+  }
+
+  // The viewport is left on the patch, which is fine as long as this is the pass's last draw.
+  const std::uint32_t patch_width = std::min(marker_size, width);
+  const std::uint32_t patch_height = std::min(marker_size, height);
+  const wgpu::Color color = marker_color(frame_tag_, format);
+  pass.SetPipeline(marker_pipeline_);
+  pass.SetBlendConstant(&color);
+  pass.SetViewport(static_cast<float>(width - patch_width), static_cast<float>(height - patch_height),
+                   static_cast<float>(patch_width), static_cast<float>(patch_height), 0.0f, 1.0f);
+  pass.Draw(3);
+
+  frame_readback_ = slot;
+}
+
+void input_latency_tracker::frame_submitted(const wgpu::Queue& queue) {
+  if (frame_tag_ == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    state_->pending.push_back(pending_frame{frame_tag_, frame_input_, clock::now()});
+  }
+
+  queue.OnSubmittedWorkDone(wgpu::CallbackMode::AllowSpontaneous,
+                            [state = state_, tag = frame_tag_](wgpu::QueueWorkDoneStatus, wgpu::StringView) {
+                              const auto now = clock::now();
+                              std::lock_guard<std::mutex> lock{state->mutex};
+                              const auto it = std::find_if(state->pending.begin(), state->pending.end(),
+                                                           [tag](const auto& frame) { return frame.tag == tag; });
+                              if (it != state->pending.end()) {
+                                it->gpu_done = now;
+                                state->complete_if_done(tag);
+                              }
+                            });
+}
+
+void input_latency_tracker::submit_marker_readback(const wgpu::Device& device, const wgpu::Texture& texture) {
+  if (!frame_readback_) {
+    return;
+  }
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  Q_ASSERT(texture.GetUsage() & wgpu::TextureUsage::CopySrc);
+  const std::size_t slot = *frame_readback_;
+  frame_readback_.reset();
+
+  // Copy rows are 256-byte aligned.
+  constexpr std::uint32_t bytes_per_row = 256;
+  wgpu::Buffer& readback = readback_buffers_[slot];
+  if (!readback) {
+    wgpu::BufferDescriptor descriptor{};
+    descriptor.label = "Latency marker readback";
+    descriptor.size = bytes_per_row;
+    descriptor.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+    readback = device.CreateBuffer(&descriptor);
+  }
+
+  // A submission of its own, so the texel is read from what the frame's commands left in the texture.
+  wgpu::TexelCopyTextureInfo corner{};
+  corner.texture = texture;
+  corner.origin = {texture.GetWidth() - 1, texture.GetHeight() - 1, 0};
+  wgpu::TexelCopyBufferInfo readback_copy{};
+  readback_copy.buffer = readback;
+  readback_copy.layout.bytesPerRow = bytes_per_row;
+  readback_copy.layout.rowsPerImage = 1;
+  const wgpu::Extent3D texel_extent{1, 1, 1};
+  wgpu::CommandEncoderDescriptor encoder_desc{};
+  encoder_desc.label = "Latency marker readback";
+  const auto encoder = device.CreateCommandEncoder(&encoder_desc);
+  encoder.CopyTextureToBuffer(&corner, &readback_copy, &texel_extent);
+  wgpu::CommandBufferDescriptor command_desc{};
+  const wgpu::CommandBuffer command = encoder.Finish(&command_desc);
+  device.GetQueue().Submit(1, &command);
+
+  readback.MapAsync(wgpu::MapMode::Read, 0, 4, wgpu::CallbackMode::AllowSpontaneous,
+                    [state = state_, buffer = readback, slot, tag = frame_tag_](wgpu::MapAsyncStatus status,
+                                                                                 wgpu::StringView message) {
+                      std::array<std::uint8_t, 4> texel{};
+                      const bool mapped = status == wgpu::MapAsyncStatus::Success;
+                      if (mapped) {
+                        std::memcpy(texel.data(), buffer.GetConstMappedRange(0, texel.size()), texel.size());
+                        buffer.Unmap();
+                      } else {
+                        fmt::print("Latency marker readback failed [status = {}]: {}\n", fmt_enum(status), message);
+                      }
+                      std::lock_guard<std::mutex> lock{state->mutex};
+                      state->readback_busy[slot] = false;
+                      if (mapped) {
+                        ++state->markers_checked;
+                        state->markers_matched += marker_matches(texel, tag) ? 1 : 0;
+                      }
+                    });
+}
+
+void input_latency_tracker::frame_presented() {
+  if (frame_tag_ == 0) {
+    return;
+  }
+  const auto now = clock::now();
+  std::lock_guard<std::mutex> lock{state_->mutex};
+  const std::uint64_t tag = frame_tag_;
+  const auto it = std::find_if(state_->pending.begin(), state_->pending.end(),
+                               [tag](const auto& frame) { return frame.tag == tag; });
+  if (it != state_->pending.end()) {
+    it->presented = now;
+    state_->complete_if_done(tag);
+  }
+  frame_tag_ = 0;
+}
+
+input_latency_stats input_latency_tracker::stats() const {
+  input_latency_stats stats{};
+  std::vector<microseconds> to_submit{};
+  std::vector<microseconds> to_gpu_done{};
+  std::vector<microseconds> to_present{};
+  {
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    stats.markers_checked = state_->markers_checked;
+    stats.markers_matched = state_->markers_matched;
+    stats.frame_count = std::min<std::uint64_t>(state_->sample_count, history_size);
+    for (std::size_t i = 0; i < stats.frame_count; ++i) {
+      to_submit.push_back(state_->samples[i].to_submit);
+      to_gpu_done.push_back(state_->samples[i].to_gpu_done);
+      to_present.push_back(state_->samples[i].to_present);
+    }
+  }
+  if (stats.frame_count == 0) {
+    return stats;
+  }
+  stats.to_submit = make_percentiles(to_submit);
+  stats.to_gpu_done = make_percentiles(to_gpu_done);
+  stats.to_present = make_percentiles(to_present);
+  return stats;
+}
+
+}  // namespace wgpu_utils
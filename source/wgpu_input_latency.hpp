@@ -0,0 +1,139 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+struct latency_percentiles {
+  std::chrono::microseconds p50{0};
+  std::chrono::microseconds p95{0};
+  std::chrono::microseconds p99{0};
+};
+
+// Latency from an input event to each stage of the frame that first consumed it, over recent frames.
+struct input_latency_stats {
+  // Number of frames the percentiles are computed over.
+  std::uint64_t frame_count{0};
+  latency_percentiles to_submit{};
+  latency_percentiles to_gpu_done{};
+  // Present is timestamped when `Surface::Present` returns, which is usually before the GPU has finished the frame:
+  // present only queues it. A frame can't be shown before it is finished, so this is the later of the two times, and
+  // is never less than `to_gpu_done`.
+  latency_percentiles to_present{};
+  // Marker test mode: tagged frames read back, and how many of them held their own tag's marker.
+  std::uint64_t markers_checked{0};
+  std::uint64_t markers_matched{0};
+};
+
+// Measures input-to-display latency. Input events are timestamped as they arrive, and the next frame encoded after
+// them is tagged. The tagged frame is then followed through `Queue::Submit`, `OnSubmittedWorkDone` and
+// `Surface::Present`.
+//
+// Present is the last point we can observe: the image reaches the display at a later vblank, so true
+// input-to-photon latency is higher by up to one refresh interval (more with deep swap chains).
+//
+// Marker test mode checks what the frame rendered. Each tagged frame draws a square patch in its bottom-right corner,
+// as the last draw of its main render pass. The patch is magenta, with the low 4 bits of the frame's tag in its green
+// channel, in steps of 17 so that sRGB encoding and MSAA resolves can't move it to a neighbouring value. A separate
+// submission after the frame's own copies the corner texel out of the surface texture, and it is compared with the
+// tag of the frame it was drawn for. A mismatch means the texture about to be presented doesn't hold that frame's
+// rendering. The check still ends at `Present`: point a camera at the flashing patch to see what reaches the
+// display.
+class input_latency_tracker {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  // Side of the marker patch, in pixels.
+  static constexpr std::uint32_t marker_size = 16;
+
+  input_latency_tracker();
+
+  // Call when an input event arrives. Events that arrive before the next frame are coalesced, and the frame is
+  // attributed to the oldest of them.
+  void record_input(clock::time_point time = clock::now());
+
+  // Call before encoding a frame. Returns true if the frame consumes input, in which case it is tagged.
+  bool begin_frame();
+
+  void set_marker_enabled(bool enabled) noexcept { marker_enabled_ = enabled; }
+  constexpr bool marker_enabled() const noexcept { return marker_enabled_; }
+
+  // Draw the marker into the bottom-right corner of the tagged frame. Call at the end of the frame's last render pass,
+  // which targets a `width` x `height` texture of `format`, with a `Depth32Float` depth attachment. Does nothing when
+  // the frame isn't tagged, or too many readbacks are outstanding.
+  void draw_marker(const wgpu::Device& device, const wgpu::RenderPassEncoder& pass, wgpu::TextureFormat format,
+                   std::uint32_t sample_count, std::uint32_t width, std::uint32_t height);
+
+  // Call immediately after `Queue::Submit`.
+  void frame_submitted(const wgpu::Queue& queue);
+
+  // Submit a copy of the marker's corner texel out of `texture`, the frame's target, and check it once it arrives.
+  // Call after `frame_submitted` and before `Surface::Present`. `texture` needs `CopySrc` usage and an 8-bit RGBA or
+  // BGRA format.
+  void submit_marker_readback(const wgpu::Device& device, const wgpu::Texture& texture);
+
+  // Call immediately after `Surface::Present`.
+  void frame_presented();
+
+  input_latency_stats stats() const;
+
+ private:
+  static constexpr std::size_t history_size = 512;
+  static constexpr std::size_t readback_count = 4;
+
+  struct frame_sample {
+    std::chrono::microseconds to_submit{0};
+    std::chrono::microseconds to_gpu_done{0};
+    std::chrono::microseconds to_present{0};
+  };
+
+  // A tagged frame that has been submitted, but not yet both completed and presented.
+  struct pending_frame {
+    std::uint64_t tag{0};
+    clock::time_point input{};
+    clock::time_point submitted{};
+    std::optional<clock::time_point> gpu_done{};
+    std::optional<clock::time_point> presented{};
+  };
+
+  // Written from the completion and map callbacks, which may fire on another thread.
+  struct shared_state {
+    mutable std::mutex mutex;
+    std::vector<pending_frame> pending{};
+    std::array<frame_sample, history_size> samples{};
+    std::uint64_t sample_count{0};
+    std::array<bool, readback_count> readback_busy{};
+    std::uint64_t markers_checked{0};
+    std::uint64_t markers_matched{0};
+
+    // Move the frame `tag` into the history once both of its remaining timestamps are known.
+    void complete_if_done(std::uint64_t tag);
+  };
+
+  bool marker_enabled_{false};
+  std::optional<clock::time_point> pending_input_{};
+
+  // The frame being encoded, if it's tagged.
+  std::uint64_t next_tag_{1};
+  std::uint64_t frame_tag_{0};
+  clock::time_point frame_input_{};
+  std::optional<std::size_t> frame_readback_{};
+
+  // Marker pipeline, for the format and sample count it was last drawn with.
+  wgpu::RenderPipeline marker_pipeline_{};
+  wgpu::TextureFormat marker_format_{wgpu::TextureFormat::Undefined};
+  std::uint32_t marker_sample_count_{0};
+
+  // Per readback slot: the texel copied out of the frame.
+  std::array<wgpu::Buffer, readback_count> readback_buffers_{};
+  std::shared_ptr<shared_state> state_;
+};
+
+}  // namespace wgpu_utils
@@ -0,0 +1,402 @@
+#include "wgpu_mesh.hpp"
+
+#include <QFile>
+#include <qassert.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_error_scope.hpp"
+#include "wgpu_fmt.hpp"
+
+namespace wgpu_utils {
+
+std::uint32_t mesh_vertex_stride(const std::uint32_t attributes) noexcept {
+  std::uint32_t stride = 0;
+  if (attributes & mesh_attribute_position) stride += sizeof(float) * 3;
+  if (attributes & mesh_attribute_normal) stride += sizeof(float) * 3;
+  if (attributes & mesh_attribute_color) stride += sizeof(std::uint8_t) * 4;
+  return stride;
+}
+
+std::uint32_t mesh_index_size(const mesh_index_format format) noexcept {
+  switch (format) {
+    case mesh_index_format::uint16:
+      return 2;
+    case mesh_index_format::uint32:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// Check that [offset, offset + count * element_size) fits in a file of `file_size` bytes, without overflowing.
+static bool blob_fits(const std::uint64_t offset, const std::uint64_t count, const std::uint64_t element_size,
+                      const std::uint64_t file_size) {
+  if (offset > file_size) {
+    return false;
+  }
+  if (element_size > 0 && count > (file_size - offset) / element_size) {
+    return false;
+  }
+  return true;
+}
+
+std::optional<mesh_file> mesh_file::open(const std::string& path) {
+  auto file = std::make_unique<QFile>(QString::fromStdString(path));
+  if (!file->open(QIODevice::ReadOnly)) {
+    fmt::print("Failed to open mesh file: {} ({})\n", path, file->errorString().toStdString());
+    return std::nullopt;
+  }
+  const auto file_size = static_cast<std::uint64_t>(file->size());
+  if (file_size < sizeof(mesh_file_header)) {
+    fmt::print("Mesh file is too small to contain a header: {}\n", path);
+    return std::nullopt;
+  }
+
+  // Map the whole file. Pages are only faulted in as wgpu reads from them.
+  const uchar* const mapped = file->map(0, file->size());
+  if (!mapped) {
+    fmt::print("Failed to map mesh file: {} ({})\n", path, file->errorString().toStdString());
+    return std::nullopt;
+  }
+
+  const auto* const header = reinterpret_cast<const mesh_file_header*>(mapped);
+  if (header->magic != mesh_file_header{}.magic || header->version != mesh_file_header{}.version) {
+    fmt::print("Not a mesh file, or unsupported version: {}\n", path);
+    return std::nullopt;
+  }
+  if (!(header->attributes & mesh_attribute_position) ||
+      header->vertex_stride != mesh_vertex_stride(header->attributes)) {
+    fmt::print("Invalid vertex layout in mesh file: {} (attributes = {:#x}, stride = {})\n", path,
+               header->attributes, header->vertex_stride);
+    return std::nullopt;
+  }
+  if (!magic_enum::enum_contains(header->topology)) {
+    fmt::print("Unknown topology in mesh file: {} (topology = {})\n", path,
+               static_cast<std::uint32_t>(header->topology));
+    return std::nullopt;
+  }
+  const std::uint32_t index_size = mesh_index_size(header->index_format);
+  if (header->index_count > 0 && index_size == 0) {
+    fmt::print("Mesh file has indices but no index format: {}\n", path);
+    return std::nullopt;
+  }
+  if (header->index_count > 0 && header->vertex_count == 0) {
+    fmt::print("Mesh file has indices but no vertices: {}\n", path);
+    return std::nullopt;
+  }
+  if (header->vertex_offset % mesh_blob_alignment != 0 || header->index_offset % mesh_blob_alignment != 0 ||
+      !blob_fits(header->vertex_offset, header->vertex_count, header->vertex_stride, file_size) ||
+      !blob_fits(header->index_offset, header->index_count, index_size, file_size)) {
+    fmt::print("Mesh file blobs are misaligned or truncated: {}\n", path);
+    return std::nullopt;
+  }
+
+  const auto* const bytes = reinterpret_cast<const std::byte*>(mapped);
+  mesh_file mesh{};
+  mesh.header_ = header;
+  mesh.vertex_data_ = {bytes + header->vertex_offset, header->vertex_count * header->vertex_stride};
+  mesh.index_data_ = {bytes + header->index_offset, header->index_count * index_size};
+  mesh.file_ = std::move(file);
+  return mesh;
+}
+
+mesh_file::mesh_file(mesh_file&&) noexcept = default;
+mesh_file& mesh_file::operator=(mesh_file&&) noexcept = default;
+mesh_file::~mesh_file() = default;
+
+// Write all of `data`, returning false if any of it could not be written.
+static bool write_all(QFile& file, const void* const data, const std::uint64_t size) {
+  return file.write(static_cast<const char*>(data), static_cast<qint64>(size)) == static_cast<qint64>(size);
+}
+
+// Write zeros until the file position is a multiple of `mesh_blob_alignment`.
+static bool pad_to_alignment(QFile& file) {
+  static constexpr std::array<char, mesh_blob_alignment> zeros{};
+  const auto remainder = static_cast<std::uint64_t>(file.pos()) % mesh_blob_alignment;
+  return remainder == 0 || write_all(file, zeros.data(), mesh_blob_alignment - remainder);
+}
+
+bool write_mesh_file(const std::string& path, const std::uint32_t attributes, const mesh_topology topology,
+                     const std::span<const std::byte> vertex_data, const mesh_index_format index_format,
+                     const std::span<const std::byte> index_data) {
+  mesh_file_header header{};
+  header.attributes = attributes;
+  header.vertex_stride = mesh_vertex_stride(attributes);
+  header.topology = topology;
+  header.index_format = index_data.empty() ? mesh_index_format::none : index_format;
+  Q_ASSERT(attributes & mesh_attribute_position);
+  Q_ASSERT(vertex_data.size() % header.vertex_stride == 0);
+  header.vertex_count = vertex_data.size() / header.vertex_stride;
+  if (!index_data.empty()) {
+    Q_ASSERT(mesh_index_size(index_format) > 0 && index_data.size() % mesh_index_size(index_format) == 0);
+    header.index_count = index_data.size() / mesh_index_size(index_format);
+  }
+
+  // Position is always the first attribute in a vertex.
+  header.bounds_min.fill(std::numeric_limits<float>::max());
+  header.bounds_max.fill(std::numeric_limits<float>::lowest());
+  for (std::size_t v = 0; v < header.vertex_count; ++v) {
+    std::array<float, 3> p{};
+    std::memcpy(p.data(), vertex_data.data() + v * header.vertex_stride, sizeof(p));
+    for (std::size_t i = 0; i < 3; ++i) {
+      header.bounds_min[i] = std::min(header.bounds_min[i], p[i]);
+      header.bounds_max[i] = std::max(header.bounds_max[i], p[i]);
+    }
+  }
+  if (header.vertex_count == 0) {
+    header.bounds_min.fill(0.0f);
+    header.bounds_max.fill(0.0f);
+  }
+
+  QFile file{QString::fromStdString(path)};
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    fmt::print("Failed to open mesh file for writing: {} ({})\n", path, file.errorString().toStdString());
+    return false;
+  }
+
+  // Write a placeholder header, then fill in the offsets once the blobs are placed.
+  bool written = write_all(file, &header, sizeof(header)) && pad_to_alignment(file);
+  header.vertex_offset = static_cast<std::uint64_t>(file.pos());
+  written = written && write_all(file, vertex_data.data(), vertex_data.size()) && pad_to_alignment(file);
+  header.index_offset = static_cast<std::uint64_t>(file.pos());
+  written = written && write_all(file, index_data.data(), index_data.size());
+  written = written && file.seek(0) && write_all(file, &header, sizeof(header)) && file.flush();
+  if (!written) {
+    fmt::print("Failed to write mesh file: {} ({})\n", path, file.errorString().toStdString());
+    return false;
+  }
+  return true;
+}
+
+// Block until all work submitted to the queue so far has completed.
+static void wait_for_submitted_work(const wgpu::Device& device) {
+  bool done = false;
+  device.GetQueue().OnSubmittedWorkDone(wgpu::CallbackMode::AllowSpontaneous,
+                                        [&](wgpu::QueueWorkDoneStatus, wgpu::StringView) { done = true; });
+  while (!done) {
+    device.Tick();
+  }
+}
+
+// WriteBuffer requires sizes that are a multiple of 4.
+static constexpr std::uint64_t round_up_to_4(const std::uint64_t size) noexcept { return (size + 3) & ~3ull; }
+
+// Write `data` into `buffer` at `buffer_offset`, reading straight from the (mapped) source. Whole multiples of 4 are
+// written directly, and the (at most 3 byte) tail is padded. If `chunk_size` is non-zero, the data is written in
+// chunks and we wait for each one to be consumed, so dawn never holds more than one chunk of staging memory.
+static void write_blob(const wgpu::Device& device, const wgpu::Buffer& buffer, const std::uint64_t buffer_offset,
+                       const std::span<const std::byte> data, const std::uint64_t chunk_size) {
+  const wgpu::Queue queue = device.GetQueue();
+  const std::uint64_t aligned_size = data.size() & ~3ull;
+  const std::uint64_t step = chunk_size > 0 ? std::max<std::uint64_t>(chunk_size & ~3ull, 4) : aligned_size;
+  for (std::uint64_t offset = 0; offset < aligned_size; offset += step) {
+    const std::uint64_t size = std::min(step, aligned_size - offset);
+    write_buffer(queue, buffer, buffer_offset + offset, data.data() + offset, size);
+    if (chunk_size > 0) {
+      queue.Submit(0, nullptr);
+      wait_for_submitted_work(device);
+    }
+  }
+  if (aligned_size < data.size()) {
+    std::array<std::byte, 4> tail{};
+    std::memcpy(tail.data(), data.data() + aligned_size, data.size() - aligned_size);
+    write_buffer(queue, buffer, buffer_offset + aligned_size, tail.data(), tail.size());
+  }
+}
+
+// Create a dedicated buffer and fill it with `data`.
+static buffer_allocation upload_blob(const wgpu::Device& device, const std::span<const std::byte> data,
+                                     const wgpu::BufferUsage usage, const char* const label,
+                                     const mesh_upload_mode mode, const std::uint64_t chunk_size) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  wgpu::BufferDescriptor descriptor{};
+  descriptor.label = label;
+  descriptor.size = round_up_to_4(data.size());
+  descriptor.usage = usage | wgpu::BufferUsage::CopyDst;
+  descriptor.mappedAtCreation = mode == mesh_upload_mode::mapped_at_creation;
+  buffer_allocation out{};
+  out.buffer = create_buffer(device, descriptor);
+  out.size = descriptor.size;
+  if (!out.buffer) {
+    return out;
+  }
+
+  if (mode == mesh_upload_mode::mapped_at_creation) {
+    void* const dst = out.buffer.GetMappedRange(0, descriptor.size);
+    Q_ASSERT(dst);
+    std::memcpy(dst, data.data(), data.size());
+    out.buffer.Unmap();
+    // A capture has no mapped memory to replay, so record the contents as a write.
+    if (capture_writer* const capture = active_capture(); capture) {
+      capture->record_write_buffer(out.buffer, 0, data.data(), data.size());
+    }
+  } else {
+    write_blob(device, out.buffer, 0, data, chunk_size);
+  }
+  return out;
+}
+
+// Largest number of `element_size` byte elements in one part of a split blob: whole primitives only, no more than
+// fit in a buffer, and no more than one draw call takes.
+static std::uint64_t max_part_count(const std::uint64_t max_buffer_size, const std::uint64_t element_size,
+                                    const std::uint64_t primitive_size) {
+  const std::uint64_t count =
+      std::min<std::uint64_t>(max_buffer_size / element_size, std::numeric_limits<std::uint32_t>::max());
+  return count - count % primitive_size;
+}
+
+// Upload `count` elements of `element_size` bytes each, in dedicated buffers of at most `max_count` elements.
+static std::vector<mesh_buffer_part> upload_parts(const wgpu::Device& device, const std::span<const std::byte> data,
+                                                  const std::uint64_t count, const std::uint64_t element_size,
+                                                  const std::uint64_t max_count, const wgpu::BufferUsage usage,
+                                                  const char* const label, const mesh_upload_mode mode,
+                                                  const std::uint64_t chunk_size) {
+  Q_ASSERT(max_count > 0 && data.size() == count * element_size);
+  std::vector<mesh_buffer_part> parts{};
+  for (std::uint64_t first = 0; first < count; first += max_count) {
+    const std::uint64_t part_count = std::min(max_count, count - first);
+    const auto part_data = data.subspan(first * element_size, part_count * element_size);
+    parts.push_back({upload_blob(device, part_data, usage, label, mode, chunk_size),
+                     static_cast<std::uint32_t>(part_count)});
+  }
+  return parts;
+}
+
+// Sub-allocate a range from `heap` and fill it with `data`.
+static buffer_allocation upload_blob(const wgpu::Device& device, const std::span<const std::byte> data,
+                                     buffer_suballocator& heap) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  buffer_allocation out = heap.allocate(round_up_to_4(data.size()), 4);
+  if (out) {
+    write_blob(device, out.buffer, out.offset, data, 0);
+  }
+  return out;
+}
+
+// True if every part of `buffers` got a buffer.
+static bool all_parts_allocated(const mesh_buffers& buffers) {
+  const auto allocated = [](const mesh_buffer_part& part) { return static_cast<bool>(part.range); };
+  return std::all_of(buffers.vertices.begin(), buffers.vertices.end(), allocated) &&
+         std::all_of(buffers.indices.begin(), buffers.indices.end(), allocated);
+}
+
+static void set_index_format(const mesh_file_header& header, mesh_buffers& out) {
+  out.index_count = header.index_count;
+  out.index_format =
+      header.index_format == mesh_index_format::uint16 ? wgpu::IndexFormat::Uint16 : wgpu::IndexFormat::Uint32;
+}
+
+std::optional<mesh_buffers> upload_mesh(const wgpu::Device& device, const mesh_file& mesh,
+                                        const mesh_upload_mode mode, const std::uint64_t chunk_size) {
+  const auto& header = mesh.header();
+  wgpu::Limits limits{};
+  if (!device.GetLimits(&limits)) {
+    fmt::print("Failed to query the device limits\n");
+    return std::nullopt;
+  }
+  const std::uint64_t primitive_size = header.topology == mesh_topology::triangles ? 3 : 1;
+
+  mesh_buffers out{};
+  out.vertex_count = header.vertex_count;
+  if (header.index_count == 0) {
+    const std::uint64_t max_count = max_part_count(limits.maxBufferSize, header.vertex_stride, primitive_size);
+    if (max_count == 0) {
+      fmt::print("Mesh vertices don't fit in a buffer of at most {} bytes\n", limits.maxBufferSize);
+      return std::nullopt;
+    }
+    out.vertices = upload_parts(device, mesh.vertex_data(), header.vertex_count, header.vertex_stride, max_count,
+                                wgpu::BufferUsage::Vertex, "Mesh vertex buffer", mode, chunk_size);
+    if (!all_parts_allocated(out)) {
+      fmt::print("Failed to create mesh vertex buffers\n");
+      return std::nullopt;
+    }
+    return out;
+  }
+
+  // Indices may refer to any vertex, so the vertices can't be split.
+  if (round_up_to_4(mesh.vertex_data().size()) > limits.maxBufferSize) {
+    fmt::print("Indexed mesh has {} MiB of vertices, but the device allows buffers of at most {} MiB\n",
+               mesh.vertex_data().size() >> 20, limits.maxBufferSize >> 20);
+    return std::nullopt;
+  }
+  const std::uint64_t index_size = mesh_index_size(header.index_format);
+  const std::uint64_t max_index_count = max_part_count(limits.maxBufferSize, index_size, primitive_size);
+  if (max_index_count == 0) {
+    fmt::print("Mesh indices don't fit in a buffer of at most {} bytes\n", limits.maxBufferSize);
+    return std::nullopt;
+  }
+  out.vertices.push_back({upload_blob(device, mesh.vertex_data(), wgpu::BufferUsage::Vertex, "Mesh vertex buffer",
+                                      mode, chunk_size),
+                          static_cast<std::uint32_t>(std::min<std::uint64_t>(
+                              header.vertex_count, std::numeric_limits<std::uint32_t>::max()))});
+  set_index_format(header, out);
+  out.indices = upload_parts(device, mesh.index_data(), header.index_count, index_size, max_index_count,
+                             wgpu::BufferUsage::Index, "Mesh index buffer", mode, chunk_size);
+  if (!all_parts_allocated(out)) {
+    fmt::print("Failed to create mesh vertex or index buffers\n");
+    return std::nullopt;
+  }
+  return out;
+}
+
+std::optional<mesh_buffers> upload_mesh(const wgpu::Device& device, const mesh_file& mesh,
+                                        buffer_suballocator& vertex_heap, buffer_suballocator& index_heap) {
+  Q_ASSERT(vertex_heap.usage_class() == buffer_usage_class::vertex);
+  Q_ASSERT(index_heap.usage_class() == buffer_usage_class::index);
+  const auto& header = mesh.header();
+  // A heap is far smaller than the number of elements one draw call takes.
+  Q_ASSERT(header.vertex_count <= std::numeric_limits<std::uint32_t>::max() &&
+           header.index_count <= std::numeric_limits<std::uint32_t>::max());
+  mesh_buffers out{};
+  out.vertex_count = header.vertex_count;
+  out.vertices.push_back(
+      {upload_blob(device, mesh.vertex_data(), vertex_heap), static_cast<std::uint32_t>(header.vertex_count)});
+  if (header.index_count > 0) {
+    set_index_format(header, out);
+    out.indices.push_back(
+        {upload_blob(device, mesh.index_data(), index_heap), static_cast<std::uint32_t>(header.index_count)});
+  }
+  if (!all_parts_allocated(out)) {
+    // Nothing has drawn from the ranges that were allocated, so they can be reused straight away.
+    fmt::print("Failed to allocate mesh ranges from the vertex and index heaps\n");
+    for (const auto& part : out.vertices) {
+      if (part.range) vertex_heap.free(part.range, 0);
+    }
+    for (const auto& part : out.indices) {
+      if (part.range) index_heap.free(part.range, 0);
+    }
+    return std::nullopt;
+  }
+  return out;
+}
+
+std::vector<wgpu::VertexAttribute> mesh_vertex_attributes(const std::uint32_t attributes) {
+  std::vector<wgpu::VertexAttribute> out{};
+  std::uint64_t offset = 0;
+  const auto add_attribute = [&](const wgpu::VertexFormat format, const std::uint32_t location,
+                                 const std::uint64_t size) {
+    wgpu::VertexAttribute attribute{};
+    attribute.format = format;
+    attribute.offset = offset;
+    attribute.shaderLocation = location;
+    out.push_back(attribute);
+    offset += size;
+  };
+  if (attributes & mesh_attribute_position) {
+    add_attribute(wgpu::VertexFormat::Float32x3, 0, sizeof(float) * 3);
+  }
+  if (attributes & mesh_attribute_normal) {
+    add_attribute(wgpu::VertexFormat::Float32x3, 1, sizeof(float) * 3);
+  }
+  if (attributes & mesh_attribute_color) {
+    add_attribute(wgpu::VertexFormat::Unorm8x4, 2, sizeof(std::uint8_t) * 4);
+  }
+  return out;
+}
+
+}  // namespace wgpu_utils
@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+#include "wgpu_buffer_allocator.hpp"
+
+class QFile;
+
+namespace wgpu_utils {
+
+// Bit flags describing which attributes are interleaved in the vertex blob, in this order.
+enum mesh_attribute : std::uint32_t {
+  mesh_attribute_position = 1 << 0,  // float32x3, always present.
+  mesh_attribute_normal = 1 << 1,    // float32x3
+  mesh_attribute_color = 1 << 2,     // unorm8x4
+};
+
+enum class mesh_index_format : std::uint32_t { none = 0, uint16 = 1, uint32 = 2 };
+enum class mesh_topology : std::uint32_t { triangles = 0, points = 1 };
+
+// Both blobs start on a multiple of this, so they can be handed to wgpu straight out of the mapped file.
+constexpr std::uint64_t mesh_blob_alignment = 256;
+
+// On-disk header of a binary mesh/point-cloud file. The file is laid out as:
+//  [header][padding][vertex blob][padding][index blob]
+// All values are little-endian. Offsets are relative to the start of the file.
+struct mesh_file_header {
+  std::array<char, 4> magic{'Q', 'W', 'M', 'F'};
+  std::uint32_t version{1};
+  std::uint32_t attributes{mesh_attribute_position};
+  std::uint32_t vertex_stride{0};
+  std::uint64_t vertex_count{0};
+  std::uint64_t vertex_offset{0};
+  std::uint64_t index_count{0};
+  std::uint64_t index_offset{0};
+  mesh_index_format index_format{mesh_index_format::none};
+  mesh_topology topology{mesh_topology::triangles};
+  std::array<float, 3> bounds_min{0.0f, 0.0f, 0.0f};
+  std::array<float, 3> bounds_max{0.0f, 0.0f, 0.0f};
+};
+static_assert(sizeof(mesh_file_header) == 80);
+
+// Size of one vertex in bytes for the given attribute mask.
+std::uint32_t mesh_vertex_stride(std::uint32_t attributes) noexcept;
+
+// Size of one index in bytes (zero if the mesh is not indexed).
+std::uint32_t mesh_index_size(mesh_index_format format) noexcept;
+
+// A memory-mapped mesh file. The vertex and index spans point directly into the mapping, and remain valid for the
+// lifetime of this object.
+class mesh_file {
+ public:
+  // Map the file at `path` and validate the header. Returns nullopt (and prints the reason) on failure.
+  static std::optional<mesh_file> open(const std::string& path);
+
+  mesh_file(mesh_file&&) noexcept;
+  mesh_file& operator=(mesh_file&&) noexcept;
+  ~mesh_file();
+
+  constexpr const mesh_file_header& header() const noexcept { return *header_; }
+  constexpr std::span<const std::byte> vertex_data() const noexcept { return vertex_data_; }
+  constexpr std::span<const std::byte> index_data() const noexcept { return index_data_; }
+
+ private:
+  mesh_file() = default;
+
+  std::unique_ptr<QFile> file_;
+  const mesh_file_header* header_{nullptr};
+  std::span<const std::byte> vertex_data_{};
+  std::span<const std::byte> index_data_{};
+};
+
+// Write a mesh file. `vertex_data` must be interleaved according to `attributes`. Bounds are computed from the
+// vertex positions. Returns false (and prints the reason) on failure.
+bool write_mesh_file(const std::string& path, std::uint32_t attributes, mesh_topology topology,
+                     std::span<const std::byte> vertex_data, mesh_index_format index_format,
+                     std::span<const std::byte> index_data);
+
+// How mesh blobs are transferred to the GPU.
+enum class mesh_upload_mode {
+  // Copy the whole blob once into a buffer created with `mappedAtCreation`.
+  mapped_at_creation,
+  // Feed the blob to `Queue::WriteBuffer` in fixed-size chunks, waiting for each chunk to be consumed so that the
+  // staging memory used by dawn stays bounded.
+  streamed,
+};
+
+// A vertex or index buffer range of a mesh, and the number of vertices or indices in it.
+struct mesh_buffer_part {
+  buffer_allocation range{};
+  std::uint32_t count{0};
+};
+
+// GPU buffers for a mesh. The ranges are either dedicated buffers, or sub-allocated from shared heaps.
+//
+// A blob larger than the device's `maxBufferSize`, or with more elements than one draw call takes, is split over
+// several dedicated buffers at primitive boundaries, and each part is drawn with a call of its own. So a non-indexed
+// mesh may have several vertex parts. An indexed mesh has exactly one vertex part, as any index may refer to any
+// vertex, and may have several index parts.
+struct mesh_buffers {
+  std::vector<mesh_buffer_part> vertices{};
+  std::vector<mesh_buffer_part> indices{};
+  std::uint64_t vertex_count{0};
+  std::uint64_t index_count{0};
+  wgpu::IndexFormat index_format{wgpu::IndexFormat::Undefined};
+};
+
+// Upload the contents of a mapped mesh file, copying directly from the mapping with no intermediate copy. Returns
+// nullopt (and prints the reason) if the mesh can't be held in buffers of the size the device allows, or the buffers
+// can't be created.
+std::optional<mesh_buffers> upload_mesh(const wgpu::Device& device, const mesh_file& mesh, mesh_upload_mode mode,
+                                        std::uint64_t chunk_size = 64 << 20);
+
+// Upload the contents of a mapped mesh file into ranges sub-allocated from shared vertex and index heaps. Each blob
+// must fit in one heap. Returns nullopt (and prints the reason) if a range can't be allocated.
+std::optional<mesh_buffers> upload_mesh(const wgpu::Device& device, const mesh_file& mesh,
+                                        buffer_suballocator& vertex_heap, buffer_suballocator& index_heap);
+
+// Vertex attributes for a mesh with the given attribute mask. Shader locations are 0 (position), 1 (normal) and
+// 2 (color); absent attributes are skipped.
+std::vector<wgpu::VertexAttribute> mesh_vertex_attributes(std::uint32_t attributes);
+
+}  // namespace wgpu_utils
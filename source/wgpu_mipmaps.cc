@@ -0,0 +1,264 @@
+#include "wgpu_mipmaps.hpp"
+
+#include <qassert.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_error_scope.hpp"
+
+namespace wgpu_utils {
+
+// `STORAGE_FORMAT` is replaced with the WGSL name of the texture format.
+static constexpr std::string_view downsample_shader_source_code = R"wgsl(
+@group(0) @binding(0) var source: texture_2d<f32>;
+@group(0) @binding(1) var level1: texture_storage_2d<STORAGE_FORMAT, write>;
+@group(0) @binding(2) var level2: texture_storage_2d<STORAGE_FORMAT, write>;
+@group(0) @binding(3) var level3: texture_storage_2d<STORAGE_FORMAT, write>;
+@group(0) @binding(4) var level4: texture_storage_2d<STORAGE_FORMAT, write>;
+
+// Level 1 texels of this workgroup's tile, reduced in place for the following levels.
+var<workgroup> tile: array<array<vec4f, 8>, 8>;
+
+fn store(level: u32, texel: vec2u, value: vec4f) {
+  switch level {
+    case 2u: { textureStore(level2, texel, value); }
+    case 3u: { textureStore(level3, texel, value); }
+    default: { textureStore(level4, texel, value); }
+  }
+}
+
+// Weights of the texels 2x, 2x+1 and 2x+2 of a row of `size` that cover texel x of the next level. An even row is
+// halved exactly. An odd one maps 2.5 texels to each output, so its last texel still contributes and the content
+// doesn't shift.
+fn taps(x: u32, size: u32) -> vec3f {
+  if (size == 1u) {
+    return vec3f(1.0, 0.0, 0.0);
+  }
+  if (size % 2u == 0u) {
+    return vec3f(0.5, 0.5, 0.0);
+  }
+  let n = f32(size / 2u);
+  return vec3f(n - f32(x), n, f32(x) + 1.0) / f32(size);
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_main(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_id) local: vec3u) {
+  // Level 1: each invocation filters a 2x2 block of the source, or 3 texels along odd dimensions. Reads past the edge
+  // are clamped, and writes past the edge of a level are discarded.
+  let source_size = textureDimensions(source);
+  let last = vec2i(source_size) - 1;
+  let texel = group.xy * 8u + local.xy;
+  let p = vec2i(texel) * 2;
+  let wx = taps(texel.x, source_size.x);
+  let wy = taps(texel.y, source_size.y);
+  let tap_count = select(vec2i(2), vec2i(3), source_size % 2u == vec2u(1u));
+  var value = vec4f(0.0);
+  for (var j = 0; j < tap_count.y; j++) {
+    for (var i = 0; i < tap_count.x; i++) {
+      value += wx[i] * wy[j] * textureLoad(source, min(p + vec2i(i, j), last), 0);
+    }
+  }
+  textureStore(level1, texel, value);
+  tile[local.y][local.x] = value;
+
+  // Levels 2-4: a quarter as many invocations each time, each averaging a 2x2 block of the previous level. This only
+  // works while each level is exactly half the one before: an odd level's footprints cross tiles. So the dispatch
+  // stops there, and the next one continues from the last level written.
+  var size = max(source_size / 2u, vec2u(1u));
+  for (var level = 2u; level <= 4u; level++) {
+    if (any(size % 2u != vec2u(0u))) {
+      break;
+    }
+    size /= 2u;
+    workgroupBarrier();
+    let stride = 1u << (level - 1u);
+    let step = stride / 2u;
+    if (all(local.xy % stride == vec2u(0u))) {
+      let x = local.x;
+      let y = local.y;
+      let reduced = 0.25 * (tile[y][x] + tile[y][x + step] + tile[y + step][x] + tile[y + step][x + step]);
+      tile[y][x] = reduced;
+      store(level, group.xy * (8u / stride) + local.xy / stride, reduced);
+    }
+  }
+}
+)wgsl";
+
+static std::string_view storage_format_name(const wgpu::TextureFormat format) noexcept {
+  switch (format) {
+    case wgpu::TextureFormat::RGBA8Unorm:
+      return "rgba8unorm";
+    case wgpu::TextureFormat::RGBA16Float:
+      return "rgba16float";
+    case wgpu::TextureFormat::RGBA32Float:
+      return "rgba32float";
+    default:
+      return {};
+  }
+}
+
+// Levels one dispatch writes from `base`, matching the shader: the first, then more while each is exactly half the
+// size of the one before.
+static std::uint32_t levels_written(const wgpu::Texture& texture, const std::uint32_t base,
+                                    const std::uint32_t max_levels) {
+  std::uint32_t width = std::max(texture.GetWidth() >> (base + 1), 1u);
+  std::uint32_t height = std::max(texture.GetHeight() >> (base + 1), 1u);
+  std::uint32_t count = 1;
+  while (count < max_levels && width % 2 == 0 && height % 2 == 0) {
+    width /= 2;
+    height /= 2;
+    ++count;
+  }
+  return count;
+}
+
+mip_generator::mip_generator(const wgpu::Device& device) : device_(device) { Q_ASSERT(device_); }
+
+bool mip_generator::supports(const wgpu::TextureFormat format) noexcept {
+  return !storage_format_name(format).empty();
+}
+
+const mip_generator::format_pipeline& mip_generator::pipeline_for(const wgpu::TextureFormat format) {
+  const auto it = std::find_if(pipelines_.begin(), pipelines_.end(),
+                               [format](const format_pipeline& entry) { return entry.format == format; });
+  if (it != pipelines_.end()) {
+    return *it;
+  }
+  WGPU_ERROR_FUNCTION_SCOPE(device_);
+  Q_ASSERT(supports(format));
+
+  std::string source{downsample_shader_source_code};
+  const std::string_view placeholder = "STORAGE_FORMAT";
+  for (std::size_t pos = source.find(placeholder); pos != std::string::npos; pos = source.find(placeholder, pos)) {
+    source.replace(pos, placeholder.size(), storage_format_name(format));
+  }
+  wgpu::ShaderModuleDescriptor shader_desc{};
+  wgpu::ShaderSourceWGSL shader_source{};
+  shader_desc.nextInChain = &shader_source;
+  shader_source.code = source.c_str();
+  const auto shader = device_.CreateShaderModule(&shader_desc);
+
+  std::array<wgpu::BindGroupLayoutEntry, levels_per_dispatch + 1> entries{};
+  entries[0].binding = 0;
+  entries[0].visibility = wgpu::ShaderStage::Compute;
+  entries[0].texture.sampleType = wgpu::TextureSampleType::UnfilterableFloat;
+  entries[0].texture.viewDimension = wgpu::TextureViewDimension::e2D;
+  for (std::uint32_t i = 1; i < entries.size(); ++i) {
+    entries[i].binding = i;
+    entries[i].visibility = wgpu::ShaderStage::Compute;
+    entries[i].storageTexture.access = wgpu::StorageTextureAccess::WriteOnly;
+    entries[i].storageTexture.format = format;
+    entries[i].storageTexture.viewDimension = wgpu::TextureViewDimension::e2D;
+  }
+
+  format_pipeline entry{};
+  entry.format = format;
+
+  wgpu::BindGroupLayoutDescriptor bg_layout_desc{};
+  bg_layout_desc.label = "Mip generation bind group layout";
+  bg_layout_desc.entryCount = entries.size();
+  bg_layout_desc.entries = entries.data();
+  entry.bg_layout = device_.CreateBindGroupLayout(&bg_layout_desc);
+
+  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
+  pipeline_layout_desc.label = "Mip generation pipeline layout";
+  pipeline_layout_desc.bindGroupLayoutCount = 1;
+  pipeline_layout_desc.bindGroupLayouts = &entry.bg_layout;
+
+  wgpu::ComputePipelineDescriptor pipeline_desc{};
+  pipeline_desc.label = "Mip generation pipeline";
+  pipeline_desc.layout = device_.CreatePipelineLayout(&pipeline_layout_desc);
+  pipeline_desc.compute.module = shader;
+  pipeline_desc.compute.entryPoint = "cs_main";
+  entry.pipeline = device_.CreateComputePipeline(&pipeline_desc);
+
+  wgpu::TextureDescriptor unused_desc{};
+  unused_desc.label = "Unused mip levels";
+  unused_desc.size = wgpu::Extent3D{1, 1, static_cast<std::uint32_t>(entry.unused_levels.size())};
+  unused_desc.format = format;
+  unused_desc.usage = wgpu::TextureUsage::StorageBinding;
+  const wgpu::Texture unused = device_.CreateTexture(&unused_desc);
+  for (std::uint32_t layer = 0; layer < entry.unused_levels.size(); ++layer) {
+    wgpu::TextureViewDescriptor view_desc{};
+    view_desc.dimension = wgpu::TextureViewDimension::e2D;
+    view_desc.baseArrayLayer = layer;
+    view_desc.arrayLayerCount = 1;
+    entry.unused_levels[layer] = unused.CreateView(&view_desc);
+  }
+
+  pipelines_.push_back(std::move(entry));
+  return pipelines_.back();
+}
+
+void mip_generator::generate(const wgpu::CommandEncoder& encoder, const std::span<const wgpu::Texture> textures) {
+  WGPU_ERROR_FUNCTION_SCOPE(device_);
+
+  wgpu::ComputePassDescriptor pass_desc{};
+  pass_desc.label = "Mip generation";
+  const wgpu::ComputePassEncoder pass = encoder.BeginComputePass(&pass_desc);
+
+  for (const wgpu::Texture& texture : textures) {
+    Q_ASSERT((texture.GetUsage() & required_usage) == required_usage);
+    Q_ASSERT(texture.GetDimension() == wgpu::TextureDimension::e2D);
+    const std::uint32_t level_count = texture.GetMipLevelCount();
+    if (level_count < 2) {
+      continue;
+    }
+    const format_pipeline& entry = pipeline_for(texture.GetFormat());
+    pass.SetPipeline(entry.pipeline);
+
+    // Each dispatch reads the last level written by the one before. Dispatches in a pass are ordered, so no barrier
+    // is needed in between.
+    const auto level_view = [&](const std::uint32_t layer, const std::uint32_t level) {
+      wgpu::TextureViewDescriptor view_desc{};
+      view_desc.dimension = wgpu::TextureViewDimension::e2D;
+      view_desc.baseMipLevel = level;
+      view_desc.mipLevelCount = 1;
+      view_desc.baseArrayLayer = layer;
+      view_desc.arrayLayerCount = 1;
+      return texture.CreateView(&view_desc);
+    };
+    for (std::uint32_t layer = 0; layer < texture.GetDepthOrArrayLayers(); ++layer) {
+      std::uint32_t written = 0;
+      for (std::uint32_t base = 0; base + 1 < level_count; base += written) {
+        written = std::min(levels_written(texture, base, levels_per_dispatch), level_count - 1 - base);
+        std::array<wgpu::BindGroupEntry, levels_per_dispatch + 1> bindings{};
+        bindings[0].binding = 0;
+        bindings[0].textureView = level_view(layer, base);
+        for (std::uint32_t i = 1; i < bindings.size(); ++i) {
+          bindings[i].binding = i;
+          bindings[i].textureView = i <= written ? level_view(layer, base + i) : entry.unused_levels[i - 2];
+        }
+        wgpu::BindGroupDescriptor bind_group_desc{};
+        bind_group_desc.layout = entry.bg_layout;
+        bind_group_desc.entryCount = bindings.size();
+        bind_group_desc.entries = bindings.data();
+        pass.SetBindGroup(0, device_.CreateBindGroup(&bind_group_desc));
+
+        // One workgroup per 8x8 texels of the first level written.
+        const std::uint32_t width = std::max(texture.GetWidth() >> (base + 1), 1u);
+        const std::uint32_t height = std::max(texture.GetHeight() >> (base + 1), 1u);
+        pass.DispatchWorkgroups((width + 7) / 8, (height + 7) / 8);
+      }
+    }
+
+    if (capture_writer* const capture = active_capture(); capture) {
+      capture->record_generate_mips(texture);
+    }
+  }
+  pass.End();
+}
+
+void mip_generator::generate(const std::span<const wgpu::Texture> textures) {
+  wgpu::CommandEncoderDescriptor encoder_desc{};
+  encoder_desc.label = "Mip generation encoder";
+  const wgpu::CommandEncoder encoder = device_.CreateCommandEncoder(&encoder_desc);
+  generate(encoder, textures);
+  const wgpu::CommandBuffer command = encoder.Finish();
+  device_.GetQueue().Submit(1, &command);
+}
+
+}  // namespace wgpu_utils
@@ -0,0 +1,57 @@
+#pragma once
+#include <array>
+#include <span>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+// Fills the mip chains of 2D textures from level 0 with a box filter, using a compute shader. Even dimensions are
+// halved with a 2x2 box. Odd ones are filtered with 3 weighted taps, so that every source texel contributes equally
+// and arbitrary sizes don't drop their last row or column.
+//
+// Each dispatch reads one level and writes up to the next four: every workgroup downsamples a 16x16 source tile to
+// 8x8, keeps the result in workgroup memory, and reduces it to 4x4, 2x2 and 1x1 without touching the source again.
+// That only works while each level is exactly half the previous one, so a dispatch stops after an odd-sized level.
+// A 4096x4096 texture takes three dispatches, and odd sizes take more. All the textures passed to `generate` share
+// one compute pass, and pipelines are kept for reuse, so keep one generator and batch textures into few calls.
+//
+// Filtering happens on the stored values, so sRGB content is averaged in gamma space.
+class mip_generator {
+ public:
+  // Usages a texture needs, in addition to its mip levels, to be passed to `generate`.
+  static constexpr wgpu::TextureUsage required_usage =
+      wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::StorageBinding;
+
+  explicit mip_generator(const wgpu::Device& device);
+
+  // Formats we can write as storage textures: rgba8unorm, rgba16float and rgba32float.
+  static bool supports(wgpu::TextureFormat format) noexcept;
+
+  // Encode one compute pass that generates levels 1 and up of every layer of `textures`.
+  void generate(const wgpu::CommandEncoder& encoder, std::span<const wgpu::Texture> textures);
+
+  // As above, in a command buffer of its own which is submitted immediately.
+  void generate(std::span<const wgpu::Texture> textures);
+
+ private:
+  // Levels written per dispatch, one per storage binding.
+  static constexpr std::uint32_t levels_per_dispatch = 4;
+
+  struct format_pipeline {
+    wgpu::TextureFormat format{wgpu::TextureFormat::Undefined};
+    wgpu::ComputePipeline pipeline{};
+    wgpu::BindGroupLayout bg_layout{};
+    // Bound in place of levels past the end of the chain. Writes to them are discarded. One layer per binding, so no
+    // subresource is bound twice in a dispatch.
+    std::array<wgpu::TextureView, levels_per_dispatch - 1> unused_levels{};
+  };
+
+  const format_pipeline& pipeline_for(wgpu::TextureFormat format);
+
+  wgpu::Device device_;
+  std::vector<format_pipeline> pipelines_{};
+};
+
+}  // namespace wgpu_utils
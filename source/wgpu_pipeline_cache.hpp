@@ -0,0 +1,41 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <tuple>
+#include <utility>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+// Render pipelines made on first use from a variant key, and shared by every later request for an equal key.
+//
+// `Key` is a small aggregate of feature switches with defaulted comparisons. The factory maps a key to pipeline state
+// and WGSL `override` constants. Every variant is then specialized from one shader module, rather than from a copy
+// of the source per variant or from branches evaluated per fragment.
+template <typename Key>
+class pipeline_cache {
+ public:
+  using pipeline_and_layout = std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout>;
+  using factory_type = std::function<pipeline_and_layout(const Key&)>;
+
+  explicit pipeline_cache(factory_type factory) : factory_(std::move(factory)) {}
+
+  // The pipeline for `key`, created now if this is the first request for it.
+  const pipeline_and_layout& get(const Key& key) {
+    auto it = pipelines_.find(key);
+    if (it == pipelines_.end()) {
+      it = pipelines_.emplace(key, factory_(key)).first;
+    }
+    return it->second;
+  }
+
+  // Number of distinct variants created so far.
+  std::size_t size() const noexcept { return pipelines_.size(); }
+
+ private:
+  factory_type factory_;
+  std::map<Key, pipeline_and_layout> pipelines_{};
+};
+
+}  // namespace wgpu_utils
@@ -0,0 +1,533 @@
+#include "wgpu_pipelines.hpp"
+
+#include <qassert.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_error_scope.hpp"
+#include "wgpu_scene.hpp"
+
+namespace wgpu_utils {
+
+// Record how a pipeline was made, so the replayer can call the same factory.
+static void record_pipeline(const wgpu::RenderPipeline& pipeline, const wgpu::BindGroupLayout& bg_layout,
+                            const capture_pipeline_params& params) {
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_pipeline(pipeline, bg_layout, params);
+  }
+}
+
+static constexpr std::string_view shader_source_code = R"wgsl(
+// WGPU NDC coordinates are +Y goes up, +X goes right.
+const p_normalized: array<vec2f, 4> = array<vec2f, 4>(
+  vec2f(-1.0, -1.0),  // NDC bottom left
+  vec2f( 1.0, -1.0),  // NDC bottom right
+  vec2f( 1.0,  1.0),  // NDC top right
+  vec2f(-1.0,  1.0)   // NDC top left
+);
+
+// WGPU texture coordinates have x-right y-down.
+const uvs: array<vec2f, 4> = array<vec2f, 4>(
+  vec2f(0.0, 1.0),
+  vec2f(1.0, 1.0),
+  vec2f(1.0, 0.0),
+  vec2f(0.0, 0.0)
+);
+
+const colors: array<vec3f, 4> = array<vec3f, 4>(
+  vec3f(1.0, 0.0, 0.0),
+  vec3f(0.0, 1.0, 0.0),
+  vec3f(0.0, 0.0, 1.0),
+  vec3f(1.0, 1.0, 1.0),
+);
+
+const vertex_indices: array<u32, 6> = array<u32, 6>(0, 1, 2, 2, 3, 0);
+
+struct VertexOutput {
+  @builtin(position) position: vec4f,
+  @location(0) uv: vec2f,
+  @location(1) color: vec3f,
+};
+
+// Feature switches, set per pipeline variant. Branches on them are resolved when the pipeline is created.
+override vertex_colors: bool = true;
+override textured: bool = true;
+override alpha_to_coverage: bool = false;
+
+@group(0) @binding(0) var<uniform> time: f32;
+@group(0) @binding(1) var pattern: texture_2d<f32>;
+@group(0) @binding(2) var pattern_sampler: sampler;
+
+// The pattern repeats this many times across the quad, so it's heavily minified.
+const pattern_repeats = 16.0;
+
+@vertex
+fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> VertexOutput {
+  let index: u32 = vertex_indices[in_vertex_index];
+
+  // Rotate the quad as time elapses:
+  let angle = 0.2 * time;
+  let p: vec2f = p_normalized[index] * 0.5;
+  let p_rotated = mat2x2f(cos(angle), sin(angle), -sin(angle), cos(angle)) * p;
+
+  var out: VertexOutput;
+  out.position = vec4f(p_rotated, 0.0, 1.0);
+  out.uv = uvs[index];
+  out.color = colors[index];
+  return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+  var color = vec3f(1.0);
+  var alpha = 1.0;
+  if (vertex_colors) {
+    color = in.color;
+  }
+  if (textured) {
+    let pattern_color = textureSample(pattern, pattern_sampler, in.uv * pattern_repeats).rgb;
+    if (alpha_to_coverage) {
+      // Cut the dark cells out, with multisampled edges.
+      alpha = pattern_color.g;
+    } else {
+      color *= pattern_color;
+    }
+  }
+  return vec4f(color, alpha);
+}
+)wgsl";
+
+std::uint32_t toy_pipeline_switches(const toy_pipeline_key& key) noexcept {
+  return (key.vertex_colors ? toy_switch_vertex_colors : 0u) | (key.textured ? toy_switch_textured : 0u) |
+         (key.alpha_to_coverage ? toy_switch_alpha_to_coverage : 0u);
+}
+
+toy_pipeline_key make_toy_pipeline_key(const wgpu::TextureFormat format, const std::uint32_t sample_count,
+                                       const std::uint32_t switches) noexcept {
+  return toy_pipeline_key{format, sample_count, (switches & toy_switch_vertex_colors) != 0,
+                          (switches & toy_switch_textured) != 0, (switches & toy_switch_alpha_to_coverage) != 0};
+}
+
+wgpu::ShaderModule make_toy_shader_module(const wgpu::Device& device) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  wgpu::ShaderModuleDescriptor shader_desc{};
+  wgpu::ShaderSourceWGSL shader_source{};
+  shader_desc.nextInChain = &shader_source;
+  shader_source.code = shader_source_code;
+  shader_desc.label = "Toy shader";
+  return device.CreateShaderModule(&shader_desc);
+}
+
+// Create a simple pipeline that draws a quad on screen.
+std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_toy_render_pipeline(const wgpu::Device& device,
+                                                                                  const wgpu::ShaderModule& shader,
+                                                                                  const toy_pipeline_key& key) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  Q_ASSERT(!key.alpha_to_coverage || key.sample_count > 1);
+
+  std::array<wgpu::BindGroupLayoutEntry, 3> entries{};
+  entries[0].binding = 0;
+  entries[0].visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment;
+  entries[0].buffer.type = wgpu::BufferBindingType::Uniform;
+  entries[0].buffer.minBindingSize = 16;  // Rounded for alignment.
+  entries[1].binding = 1;
+  entries[1].visibility = wgpu::ShaderStage::Fragment;
+  entries[1].texture.sampleType = wgpu::TextureSampleType::Float;
+  entries[1].texture.viewDimension = wgpu::TextureViewDimension::e2D;
+  entries[2].binding = 2;
+  entries[2].visibility = wgpu::ShaderStage::Fragment;
+  entries[2].sampler.type = wgpu::SamplerBindingType::Filtering;
+
+  wgpu::BindGroupLayoutDescriptor descriptor{};
+  descriptor.entryCount = entries.size();
+  descriptor.entries = entries.data();
+  descriptor.label = "Bind group layout";
+
+  const auto bg_layout = device.CreateBindGroupLayout(&descriptor);
+
+  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
+  pipeline_layout_desc.label = "Pipeline layout";
+  pipeline_layout_desc.bindGroupLayoutCount = 1;
+  pipeline_layout_desc.bindGroupLayouts = &bg_layout;
+  const auto pipeline_layout = device.CreatePipelineLayout(&pipeline_layout_desc);
+
+  wgpu::FragmentState frag_state{};
+  frag_state.module = shader;
+  frag_state.entryPoint = "fs_main";
+
+  // Specialize the fragment shader for this variant.
+  std::array<wgpu::ConstantEntry, 3> constants{};
+  constants[0].key = "vertex_colors";
+  constants[0].value = key.vertex_colors ? 1.0 : 0.0;
+  constants[1].key = "textured";
+  constants[1].value = key.textured ? 1.0 : 0.0;
+  constants[2].key = "alpha_to_coverage";
+  constants[2].value = key.alpha_to_coverage ? 1.0 : 0.0;
+  frag_state.constantCount = constants.size();
+  frag_state.constants = constants.data();
+
+  wgpu::BlendState blend_state{};
+  blend_state.color.srcFactor = wgpu::BlendFactor::SrcAlpha;
+  blend_state.color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+  blend_state.color.operation = wgpu::BlendOperation::Add;
+  blend_state.alpha.srcFactor = wgpu::BlendFactor::Zero;
+  blend_state.alpha.dstFactor = wgpu::BlendFactor::One;
+  blend_state.alpha.operation = wgpu::BlendOperation::Add;
+
+  wgpu::ColorTargetState color_target_state{};
+  color_target_state.format = key.format;
+  // Alpha becomes coverage instead, so it mustn't also blend.
+  color_target_state.blend = key.alpha_to_coverage ? nullptr : &blend_state;
+  color_target_state.writeMask = wgpu::ColorWriteMask::All;
+  frag_state.targetCount = 1;
+  frag_state.targets = &color_target_state;
+
+  wgpu::DepthStencilState depth_state{};
+  depth_state.format = wgpu::TextureFormat::Depth32Float;
+  depth_state.depthWriteEnabled = true;
+  depth_state.depthCompare = wgpu::CompareFunction::Less;
+
+  wgpu::RenderPipelineDescriptor pipeline_descriptor{};
+  pipeline_descriptor.vertex.module = shader;
+  pipeline_descriptor.vertex.entryPoint = "vs_main";
+  pipeline_descriptor.vertex.bufferCount = 0;
+
+  pipeline_descriptor.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+  pipeline_descriptor.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+  pipeline_descriptor.primitive.frontFace = wgpu::FrontFace::CCW;
+  pipeline_descriptor.primitive.cullMode = wgpu::CullMode::Back;
+  pipeline_descriptor.fragment = &frag_state;
+  pipeline_descriptor.depthStencil = &depth_state;
+  pipeline_descriptor.multisample.count = key.sample_count;
+  pipeline_descriptor.multisample.mask = ~0u;
+  pipeline_descriptor.multisample.alphaToCoverageEnabled = key.alpha_to_coverage;
+  pipeline_descriptor.label = "Toy pipeline";
+  pipeline_descriptor.layout = pipeline_layout;
+  const auto pipeline = device.CreateRenderPipeline(&pipeline_descriptor);
+
+  capture_pipeline_params params{capture_pipeline_kind::toy, key.format, key.sample_count};
+  params.switches = toy_pipeline_switches(key);
+  record_pipeline(pipeline, bg_layout, params);
+  return std::make_tuple(pipeline, bg_layout);
+}
+
+static constexpr std::string_view mesh_shader_source_code = R"wgsl(
+struct MeshUniforms {
+  time: f32,
+  scale: f32,
+  center: vec3f,
+};
+
+struct VertexOutput {
+  @builtin(position) position: vec4f,
+  @location(0) color: vec3f,
+};
+
+@group(0) @binding(0) var<uniform> uniforms: MeshUniforms;
+// Scene graph world matrices. Instance i draws the mesh at node i.
+@group(0) @binding(1) var<storage, read> world_matrices: array<mat4x4f>;
+
+@vertex
+fn vs_main(in: VertexInput, @builtin(instance_index) instance: u32) -> VertexOutput {
+  // Normalize the mesh into the unit cube, then place it with its node's world matrix.
+  let world = world_matrices[instance];
+  let rotation = mat3x3f(world[0].xyz, world[1].xyz, world[2].xyz);
+  let p = (world * vec4f((in.position - uniforms.center) * uniforms.scale, 1.0)).xyz;
+
+  var out: VertexOutput;
+  out.position = vec4f(p.xy, p.z * 0.5 + 0.5, 1.0);
+  out.color = vertex_color(in) * vertex_shade(in, rotation);
+  return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+  return vec4f(in.color, 1.0);
+}
+)wgsl";
+
+// The vertex input struct depends on which attributes the mesh file has. Emit it, plus accessors that substitute
+// defaults for absent attributes, ahead of the shared shader body.
+static std::string make_mesh_shader_source(const std::uint32_t attributes) {
+  std::string source = "struct VertexInput {\n  @location(0) position: vec3f,\n";
+  if (attributes & mesh_attribute_normal) {
+    source += "  @location(1) normal: vec3f,\n";
+  }
+  if (attributes & mesh_attribute_color) {
+    source += "  @location(2) color: vec4f,\n";
+  }
+  source += "};\n";
+
+  if (attributes & mesh_attribute_normal) {
+    source += R"wgsl(
+fn vertex_shade(in: VertexInput, rotation: mat3x3f) -> f32 {
+  let n = normalize(rotation * in.normal);
+  return 0.3 + 0.7 * abs(dot(n, normalize(vec3f(0.3, 0.5, -1.0))));
+}
+)wgsl";
+  } else {
+    source += "fn vertex_shade(in: VertexInput, rotation: mat3x3f) -> f32 { return 1.0; }\n";
+  }
+  if (attributes & mesh_attribute_color) {
+    source += "fn vertex_color(in: VertexInput) -> vec3f { return in.color.rgb; }\n";
+  } else {
+    source += "fn vertex_color(in: VertexInput) -> vec3f { return vec3f(0.8, 0.8, 0.8); }\n";
+  }
+  source += mesh_shader_source_code;
+  return source;
+}
+
+// Create a pipeline that draws a mesh with the vertex layout described by `header`.
+std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_mesh_render_pipeline(
+    const wgpu::Device& device, const wgpu::TextureFormat surface_format, const std::uint32_t multisample_count,
+    const mesh_file_header& header) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  const std::string source = make_mesh_shader_source(header.attributes);
+  wgpu::ShaderModuleDescriptor shader_desc{};
+  wgpu::ShaderSourceWGSL shader_source{};
+  shader_desc.nextInChain = &shader_source;
+  shader_source.code = source.c_str();
+  const auto shader = device.CreateShaderModule(&shader_desc);
+
+  wgpu::BindGroupLayoutEntry entries[2]{};
+  entries[0].binding = 0;
+  entries[0].visibility = wgpu::ShaderStage::Vertex;
+  entries[0].buffer.type = wgpu::BufferBindingType::Uniform;
+  entries[0].buffer.minBindingSize = 32;
+  entries[1].binding = 1;
+  entries[1].visibility = wgpu::ShaderStage::Vertex;
+  entries[1].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+  entries[1].buffer.minBindingSize = sizeof(mat4);
+
+  wgpu::BindGroupLayoutDescriptor descriptor{};
+  descriptor.entryCount = 2;
+  descriptor.entries = entries;
+  descriptor.label = "Mesh bind group layout";
+  const auto bg_layout = device.CreateBindGroupLayout(&descriptor);
+
+  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
+  pipeline_layout_desc.label = "Mesh pipeline layout";
+  pipeline_layout_desc.bindGroupLayoutCount = 1;
+  pipeline_layout_desc.bindGroupLayouts = &bg_layout;
+  const auto pipeline_layout = device.CreatePipelineLayout(&pipeline_layout_desc);
+
+  // Vertices are read straight from the interleaved blob in the mesh file.
+  const std::vector<wgpu::VertexAttribute> attributes = mesh_vertex_attributes(header.attributes);
+  wgpu::VertexBufferLayout vertex_layout{};
+  vertex_layout.stepMode = wgpu::VertexStepMode::Vertex;
+  vertex_layout.arrayStride = header.vertex_stride;
+  vertex_layout.attributeCount = attributes.size();
+  vertex_layout.attributes = attributes.data();
+
+  wgpu::FragmentState frag_state{};
+  frag_state.module = shader;
+  frag_state.entryPoint = "fs_main";
+
+  wgpu::ColorTargetState color_target_state{};
+  color_target_state.format = surface_format;
+  color_target_state.writeMask = wgpu::ColorWriteMask::All;
+  frag_state.targetCount = 1;
+  frag_state.targets = &color_target_state;
+
+  wgpu::DepthStencilState depth_state{};
+  depth_state.format = wgpu::TextureFormat::Depth32Float;
+  depth_state.depthWriteEnabled = true;
+  depth_state.depthCompare = wgpu::CompareFunction::Less;
+
+  wgpu::RenderPipelineDescriptor pipeline_descriptor{};
+  pipeline_descriptor.vertex.module = shader;
+  pipeline_descriptor.vertex.entryPoint = "vs_main";
+  pipeline_descriptor.vertex.bufferCount = 1;
+  pipeline_descriptor.vertex.buffers = &vertex_layout;
+
+  // Winding order is unknown for arbitrary meshes, so don't cull.
+  pipeline_descriptor.primitive.topology = header.topology == mesh_topology::points
+                                               ? wgpu::PrimitiveTopology::PointList
+                                               : wgpu::PrimitiveTopology::TriangleList;
+  pipeline_descriptor.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+  pipeline_descriptor.primitive.frontFace = wgpu::FrontFace::CCW;
+  pipeline_descriptor.primitive.cullMode = wgpu::CullMode::None;
+  pipeline_descriptor.fragment = &frag_state;
+  pipeline_descriptor.depthStencil = &depth_state;
+  pipeline_descriptor.multisample.count = multisample_count;
+  pipeline_descriptor.multisample.mask = ~0u;
+  pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+  pipeline_descriptor.label = "Mesh pipeline";
+  pipeline_descriptor.layout = pipeline_layout;
+  const auto pipeline = device.CreateRenderPipeline(&pipeline_descriptor);
+  record_pipeline(pipeline, bg_layout,
+                  {capture_pipeline_kind::mesh, surface_format, multisample_count, header.attributes,
+                   static_cast<std::uint32_t>(header.topology)});
+  return std::make_tuple(pipeline, bg_layout);
+}
+
+static constexpr std::string_view overlay_shader_source_code = R"wgsl(
+@group(0) @binding(0) var overlay: texture_2d<f32>;
+
+// Single triangle covering the whole viewport.
+@vertex
+fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> @builtin(position) vec4f {
+  let uv = vec2f(f32((in_vertex_index << 1u) & 2u), f32(in_vertex_index & 2u));
+  return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+// The overlay matches the surface 1:1, so load texels by pixel coordinate.
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f {
+  return textureLoad(overlay, vec2i(position.xy), 0);
+}
+)wgsl";
+
+std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_overlay_render_pipeline(
+    const wgpu::Device& device, const wgpu::TextureFormat surface_format, const std::uint32_t multisample_count) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  wgpu::ShaderModuleDescriptor shader_desc{};
+  wgpu::ShaderSourceWGSL shader_source{};
+  shader_desc.nextInChain = &shader_source;
+  shader_source.code = overlay_shader_source_code;
+  const auto shader = device.CreateShaderModule(&shader_desc);
+
+  wgpu::BindGroupLayoutEntry entry{};
+  entry.binding = 0;
+  entry.visibility = wgpu::ShaderStage::Fragment;
+  entry.texture.sampleType = wgpu::TextureSampleType::Float;
+  entry.texture.viewDimension = wgpu::TextureViewDimension::e2D;
+
+  wgpu::BindGroupLayoutDescriptor descriptor{};
+  descriptor.entryCount = 1;
+  descriptor.entries = &entry;
+  descriptor.label = "Overlay bind group layout";
+  const auto bg_layout = device.CreateBindGroupLayout(&descriptor);
+
+  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
+  pipeline_layout_desc.label = "Overlay pipeline layout";
+  pipeline_layout_desc.bindGroupLayoutCount = 1;
+  pipeline_layout_desc.bindGroupLayouts = &bg_layout;
+  const auto pipeline_layout = device.CreatePipelineLayout(&pipeline_layout_desc);
+
+  wgpu::FragmentState frag_state{};
+  frag_state.module = shader;
+  frag_state.entryPoint = "fs_main";
+
+  // QImage content is premultiplied.
+  wgpu::BlendState blend_state{};
+  blend_state.color.srcFactor = wgpu::BlendFactor::One;
+  blend_state.color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+  blend_state.color.operation = wgpu::BlendOperation::Add;
+  blend_state.alpha.srcFactor = wgpu::BlendFactor::One;
+  blend_state.alpha.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+  blend_state.alpha.operation = wgpu::BlendOperation::Add;
+
+  wgpu::ColorTargetState color_target_state{};
+  color_target_state.format = surface_format;
+  color_target_state.blend = &blend_state;
+  color_target_state.writeMask = wgpu::ColorWriteMask::All;
+  frag_state.targetCount = 1;
+  frag_state.targets = &color_target_state;
+
+  wgpu::DepthStencilState depth_state{};
+  depth_state.format = wgpu::TextureFormat::Depth32Float;
+  depth_state.depthWriteEnabled = false;
+  depth_state.depthCompare = wgpu::CompareFunction::Always;
+
+  wgpu::RenderPipelineDescriptor pipeline_descriptor{};
+  pipeline_descriptor.vertex.module = shader;
+  pipeline_descriptor.vertex.entryPoint = "vs_main";
+  pipeline_descriptor.vertex.bufferCount = 0;
+
+  pipeline_descriptor.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+  pipeline_descriptor.primitive.cullMode = wgpu::CullMode::None;
+  pipeline_descriptor.fragment = &frag_state;
+  pipeline_descriptor.depthStencil = &depth_state;
+  pipeline_descriptor.multisample.count = multisample_count;
+  pipeline_descriptor.multisample.mask = ~0u;
+  pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+  pipeline_descriptor.label = "Overlay pipeline";
+  pipeline_descriptor.layout = pipeline_layout;
+  const auto pipeline = device.CreateRenderPipeline(&pipeline_descriptor);
+  record_pipeline(pipeline, bg_layout, {capture_pipeline_kind::overlay, surface_format, multisample_count});
+  return std::make_tuple(pipeline, bg_layout);
+}
+
+static constexpr std::string_view latency_marker_shader_source_code = R"wgsl(
+// Single triangle covering the whole viewport.
+@vertex
+fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> @builtin(position) vec4f {
+  let uv = vec2f(f32((in_vertex_index << 1u) & 2u), f32(in_vertex_index & 2u));
+  return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+// Blending multiplies this by the blend constant, which holds the marker color.
+@fragment
+fn fs_main() -> @location(0) vec4f {
+  return vec4f(1.0);
+}
+)wgsl";
+
+wgpu::RenderPipeline make_latency_marker_render_pipeline(const wgpu::Device& device,
+                                                         const wgpu::TextureFormat surface_format,
+                                                         const std::uint32_t multisample_count) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  wgpu::ShaderModuleDescriptor shader_desc{};
+  wgpu::ShaderSourceWGSL shader_source{};
+  shader_desc.nextInChain = &shader_source;
+  shader_source.code = latency_marker_shader_source_code;
+  const auto shader = device.CreateShaderModule(&shader_desc);
+
+  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
+  pipeline_layout_desc.label = "Latency marker pipeline layout";
+  pipeline_layout_desc.bindGroupLayoutCount = 0;
+  const auto pipeline_layout = device.CreatePipelineLayout(&pipeline_layout_desc);
+
+  wgpu::FragmentState frag_state{};
+  frag_state.module = shader;
+  frag_state.entryPoint = "fs_main";
+
+  // Replace the target with the blend constant, so the color can change every frame without a bind group.
+  wgpu::BlendState blend_state{};
+  blend_state.color.srcFactor = wgpu::BlendFactor::Constant;
+  blend_state.color.dstFactor = wgpu::BlendFactor::Zero;
+  blend_state.color.operation = wgpu::BlendOperation::Add;
+  blend_state.alpha.srcFactor = wgpu::BlendFactor::Constant;
+  blend_state.alpha.dstFactor = wgpu::BlendFactor::Zero;
+  blend_state.alpha.operation = wgpu::BlendOperation::Add;
+
+  wgpu::ColorTargetState color_target_state{};
+  color_target_state.format = surface_format;
+  color_target_state.blend = &blend_state;
+  color_target_state.writeMask = wgpu::ColorWriteMask::All;
+  frag_state.targetCount = 1;
+  frag_state.targets = &color_target_state;
+
+  wgpu::DepthStencilState depth_state{};
+  depth_state.format = wgpu::TextureFormat::Depth32Float;
+  depth_state.depthWriteEnabled = false;
+  depth_state.depthCompare = wgpu::CompareFunction::Always;
+
+  wgpu::RenderPipelineDescriptor pipeline_descriptor{};
+  pipeline_descriptor.vertex.module = shader;
+  pipeline_descriptor.vertex.entryPoint = "vs_main";
+  pipeline_descriptor.vertex.bufferCount = 0;
+
+  pipeline_descriptor.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+  pipeline_descriptor.primitive.cullMode = wgpu::CullMode::None;
+  pipeline_descriptor.fragment = &frag_state;
+  pipeline_descriptor.depthStencil = &depth_state;
+  pipeline_descriptor.multisample.count = multisample_count;
+  pipeline_descriptor.multisample.mask = ~0u;
+  pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+  pipeline_descriptor.label = "Latency marker pipeline";
+  pipeline_descriptor.layout = pipeline_layout;
+  // Drawn straight into the render pass rather than the traced bundle, so it isn't recorded.
+  return device.CreateRenderPipeline(&pipeline_descriptor);
+}
+
+}  // namespace wgpu_utils
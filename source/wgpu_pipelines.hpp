@@ -0,0 +1,60 @@
+#pragma once
+#include <compare>
+#include <cstdint>
+#include <tuple>
+
+#include <webgpu/webgpu_cpp.h>
+
+#include "wgpu_mesh.hpp"
+
+namespace wgpu_utils {
+
+// A variant of the toy pipeline. The switches are WGSL override constants of one shared shader module.
+struct toy_pipeline_key {
+  wgpu::TextureFormat format{wgpu::TextureFormat::Undefined};
+  // 1, or 4 for MSAA.
+  std::uint32_t sample_count{4};
+  // Modulate by the per-vertex colors.
+  bool vertex_colors{true};
+  // Modulate by the pattern texture.
+  bool textured{true};
+  // Use the pattern as coverage, cutting out its dark cells. Needs MSAA, and `textured` to have any effect.
+  bool alpha_to_coverage{false};
+
+  constexpr auto operator<=>(const toy_pipeline_key&) const = default;
+};
+
+// The switches of a `toy_pipeline_key` as a bit mask, as recorded in captures.
+constexpr std::uint32_t toy_switch_vertex_colors = 1u << 0;
+constexpr std::uint32_t toy_switch_textured = 1u << 1;
+constexpr std::uint32_t toy_switch_alpha_to_coverage = 1u << 2;
+std::uint32_t toy_pipeline_switches(const toy_pipeline_key& key) noexcept;
+toy_pipeline_key make_toy_pipeline_key(wgpu::TextureFormat format, std::uint32_t sample_count,
+                                       std::uint32_t switches) noexcept;
+
+// Compile the toy shader. One module serves every variant.
+wgpu::ShaderModule make_toy_shader_module(const wgpu::Device& device);
+
+// Create a simple pipeline that draws a quad on screen. Bind group 0 holds the time (0), and a pattern texture (1)
+// and sampler (2) that are tiled across the quad. All variants have the same bind group layout.
+std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_toy_render_pipeline(const wgpu::Device& device,
+                                                                                  const wgpu::ShaderModule& shader,
+                                                                                  const toy_pipeline_key& key);
+
+// Create a pipeline that draws a mesh with the vertex layout described by `header`. Bind group 0 holds the mesh
+// uniforms (0), and the scene's world matrices (1). Instance i is drawn with the matrix of scene node i.
+std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_mesh_render_pipeline(
+    const wgpu::Device& device, wgpu::TextureFormat surface_format, std::uint32_t multisample_count,
+    const mesh_file_header& header);
+
+// Create a pipeline that composites a premultiplied overlay texture (matching the target size) over the scene.
+std::tuple<wgpu::RenderPipeline, wgpu::BindGroupLayout> make_overlay_render_pipeline(
+    const wgpu::Device& device, wgpu::TextureFormat surface_format, std::uint32_t multisample_count);
+
+// Create a pipeline that fills the viewport with the render pass's blend constant, for the input latency marker. It
+// has no bindings: set the viewport to the patch, the blend constant to its color, and draw 3 vertices.
+wgpu::RenderPipeline make_latency_marker_render_pipeline(const wgpu::Device& device,
+                                                         wgpu::TextureFormat surface_format,
+                                                         std::uint32_t multisample_count);
+
+}  // namespace wgpu_utils
@@ -0,0 +1,258 @@
+#include "wgpu_ring_buffer.hpp"
+
+#include <qassert.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_error_scope.hpp"
+
+namespace wgpu_utils {
+
+gpu_ring_buffer::gpu_ring_buffer(const wgpu::Device& device, const std::uint32_t capacity,
+                                 const std::uint32_t element_size, const std::string_view label)
+    : capacity_(capacity), element_size_(element_size) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  Q_ASSERT(capacity > 0);
+  Q_ASSERT(element_size > 0 && element_size % 4 == 0);
+
+  wgpu::BufferDescriptor descriptor{};
+  descriptor.label = label;
+  descriptor.size = static_cast<std::uint64_t>(capacity) * element_size;
+  descriptor.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage;
+  buffer_ = create_buffer(device, descriptor);
+}
+
+void gpu_ring_buffer::append(const wgpu::Queue& queue, std::span<const std::byte> elements) {
+  Q_ASSERT(elements.size() % element_size_ == 0);
+  std::uint64_t count = elements.size() / element_size_;
+  if (count == 0) {
+    return;
+  }
+
+  // Elements that would be overwritten within this same append are never written.
+  if (count > capacity_) {
+    const std::uint64_t skipped = count - capacity_;
+    head_ = static_cast<std::uint32_t>((head_ + skipped) % capacity_);
+    total_appended_ += skipped;
+    elements = elements.subspan(skipped * element_size_);
+    count = capacity_;
+  }
+
+  // Write up to the end of the ring, then wrap around to the start.
+  const std::uint64_t first_count = std::min<std::uint64_t>(count, capacity_ - head_);
+  write_buffer(queue, buffer_, static_cast<std::uint64_t>(head_) * element_size_, elements.data(),
+               first_count * element_size_);
+  if (first_count < count) {
+    write_buffer(queue, buffer_, 0, elements.data() + first_count * element_size_,
+                 (count - first_count) * element_size_);
+  }
+
+  head_ = static_cast<std::uint32_t>((head_ + count) % capacity_);
+  total_appended_ += count;
+}
+
+std::uint32_t gpu_ring_buffer::window_start(const std::uint32_t count) const noexcept {
+  const std::uint32_t n = std::min(count, size());
+  return (head_ + capacity_ - n) % capacity_;
+}
+
+plot_series::plot_series(const wgpu::Device& device, const std::uint32_t capacity)
+    : ring_(device, capacity, static_cast<std::uint32_t>(sizeof(plot_gpu_sample)), "Plot samples"),
+      history_(capacity) {}
+
+void plot_series::append(const wgpu::Queue& queue, std::span<const plot_sample> samples) {
+  if (samples.empty()) {
+    return;
+  }
+  if (samples.size() > ring_.capacity()) {
+    samples = samples.last(ring_.capacity());
+  }
+  latest_time_ = samples.back().time;
+  const bool rebase = !origin_ || std::abs(latest_time_ - *origin_) > rebase_interval;
+  if (rebase) {
+    origin_ = latest_time_;
+  }
+  const auto to_gpu = [origin = *origin_](const plot_sample& sample) {
+    return plot_gpu_sample{static_cast<float>(sample.time - origin), sample.value};
+  };
+
+  // Keep the CPU copy in the slots the ring is about to write.
+  std::vector<plot_gpu_sample> converted(samples.size());
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    history_[(ring_.total_appended() + i) % ring_.capacity()] = samples[i];
+    converted[i] = to_gpu(samples[i]);
+  }
+  ring_.append(queue, std::span<const plot_gpu_sample>{converted});
+  if (!rebase) {
+    return;
+  }
+
+  // Until the ring first fills, the stored samples are the slots [0, size).
+  converted.resize(ring_.size());
+  std::transform(history_.begin(), history_.begin() + ring_.size(), converted.begin(), to_gpu);
+  write_buffer(queue, ring_.buffer(), 0, converted.data(), converted.size() * sizeof(plot_gpu_sample));
+}
+
+plot_window plot_series::visible(const double window_seconds) const noexcept {
+  // Samples are stored in time order starting at the oldest slot, so the first one inside the window can be found by
+  // binary search on their position in that order.
+  const std::uint32_t size = ring_.size();
+  const std::uint32_t oldest = ring_.window_start(size);
+  const auto time_at = [&](const std::uint32_t k) { return history_[(oldest + k) % ring_.capacity()].time; };
+  const double start_time = latest_time_ - window_seconds;
+  std::uint32_t lo = 0;
+  std::uint32_t hi = size;
+  while (lo < hi) {
+    const std::uint32_t mid = lo + (hi - lo) / 2;
+    if (time_at(mid) < start_time) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  const std::uint32_t skipped = lo > 0 ? lo - 1 : 0;
+  return plot_window{(oldest + skipped) % ring_.capacity(), size - skipped};
+}
+
+plot_uniforms plot_series::uniforms(const plot_window& window, const double window_seconds, const float value_min,
+                                    const float value_max) const noexcept {
+  const double latest = origin_ ? latest_time_ - *origin_ : 0.0;
+  plot_uniforms out{};
+  out.first = window.first;
+  out.capacity = ring_.capacity();
+  out.view_min[0] = static_cast<float>(latest - window_seconds);
+  out.view_min[1] = value_min;
+  out.view_max[0] = static_cast<float>(latest);
+  out.view_max[1] = value_max;
+  return out;
+}
+
+static constexpr std::string_view plot_shader_source_code = R"wgsl(
+struct PlotUniforms {
+  first: u32,
+  capacity: u32,
+  view_min: vec2f,
+  view_max: vec2f,
+  color: vec4f,
+};
+
+@group(0) @binding(0) var<storage, read> samples: array<vec2f>;
+@group(0) @binding(1) var<uniform> plot: PlotUniforms;
+
+struct VertexOutput {
+  @builtin(position) position: vec4f,
+  @location(0) color: vec4f,
+};
+
+@vertex
+fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> VertexOutput {
+  // The ring wraps here, so the CPU never has to re-order or copy samples.
+  let sample = samples[(plot.first + in_vertex_index) % plot.capacity];
+  let p = (sample - plot.view_min) / (plot.view_max - plot.view_min) * 2.0 - 1.0;
+
+  var out: VertexOutput;
+  out.position = vec4f(p, 0.0, 1.0);
+  out.color = plot.color;
+  return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+  return in.color;
+}
+)wgsl";
+
+wgpu::BindGroupLayout make_plot_bind_group_layout(const wgpu::Device& device) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  wgpu::BindGroupLayoutEntry entries[2]{};
+  entries[0].binding = 0;
+  entries[0].visibility = wgpu::ShaderStage::Vertex;
+  entries[0].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+  entries[0].buffer.minBindingSize = sizeof(plot_gpu_sample);
+  entries[1].binding = 1;
+  entries[1].visibility = wgpu::ShaderStage::Vertex;
+  entries[1].buffer.type = wgpu::BufferBindingType::Uniform;
+  entries[1].buffer.minBindingSize = sizeof(plot_uniforms);
+
+  wgpu::BindGroupLayoutDescriptor descriptor{};
+  descriptor.entryCount = 2;
+  descriptor.entries = entries;
+  descriptor.label = "Plot bind group layout";
+  return device.CreateBindGroupLayout(&descriptor);
+}
+
+wgpu::RenderPipeline make_plot_render_pipeline(const wgpu::Device& device, const wgpu::BindGroupLayout& bg_layout,
+                                               const wgpu::TextureFormat surface_format,
+                                               const std::uint32_t multisample_count,
+                                               const wgpu::PrimitiveTopology topology) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  Q_ASSERT(topology == wgpu::PrimitiveTopology::LineStrip || topology == wgpu::PrimitiveTopology::PointList);
+
+  wgpu::ShaderModuleDescriptor shader_desc{};
+  wgpu::ShaderSourceWGSL shader_source{};
+  shader_desc.nextInChain = &shader_source;
+  shader_source.code = plot_shader_source_code;
+  const auto shader = device.CreateShaderModule(&shader_desc);
+
+  wgpu::PipelineLayoutDescriptor pipeline_layout_desc{};
+  pipeline_layout_desc.label = "Plot pipeline layout";
+  pipeline_layout_desc.bindGroupLayoutCount = 1;
+  pipeline_layout_desc.bindGroupLayouts = &bg_layout;
+  const auto pipeline_layout = device.CreatePipelineLayout(&pipeline_layout_desc);
+
+  wgpu::FragmentState frag_state{};
+  frag_state.module = shader;
+  frag_state.entryPoint = "fs_main";
+
+  wgpu::BlendState blend_state{};
+  blend_state.color.srcFactor = wgpu::BlendFactor::SrcAlpha;
+  blend_state.color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+  blend_state.color.operation = wgpu::BlendOperation::Add;
+  blend_state.alpha.srcFactor = wgpu::BlendFactor::Zero;
+  blend_state.alpha.dstFactor = wgpu::BlendFactor::One;
+  blend_state.alpha.operation = wgpu::BlendOperation::Add;
+
+  wgpu::ColorTargetState color_target_state{};
+  color_target_state.format = surface_format;
+  color_target_state.blend = &blend_state;
+  color_target_state.writeMask = wgpu::ColorWriteMask::All;
+  frag_state.targetCount = 1;
+  frag_state.targets = &color_target_state;
+
+  // Plots are drawn on top of the scene, in submission order.
+  wgpu::DepthStencilState depth_state{};
+  depth_state.format = wgpu::TextureFormat::Depth32Float;
+  depth_state.depthWriteEnabled = false;
+  depth_state.depthCompare = wgpu::CompareFunction::Always;
+
+  wgpu::RenderPipelineDescriptor pipeline_descriptor{};
+  pipeline_descriptor.vertex.module = shader;
+  pipeline_descriptor.vertex.entryPoint = "vs_main";
+  pipeline_descriptor.vertex.bufferCount = 0;
+
+  pipeline_descriptor.primitive.topology = topology;
+  pipeline_descriptor.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+  pipeline_descriptor.primitive.cullMode = wgpu::CullMode::None;
+  pipeline_descriptor.fragment = &frag_state;
+  pipeline_descriptor.depthStencil = &depth_state;
+  pipeline_descriptor.multisample.count = multisample_count;
+  pipeline_descriptor.multisample.mask = ~0u;
+  pipeline_descriptor.multisample.alphaToCoverageEnabled = false;
+  pipeline_descriptor.label =
+      topology == wgpu::PrimitiveTopology::LineStrip ? "Plot line pipeline" : "Plot point pipeline";
+  pipeline_descriptor.layout = pipeline_layout;
+  const auto pipeline = device.CreateRenderPipeline(&pipeline_descriptor);
+
+  if (capture_writer* const capture = active_capture(); capture) {
+    capture->record_pipeline(pipeline, bg_layout,
+                             {topology == wgpu::PrimitiveTopology::LineStrip ? capture_pipeline_kind::plot_line
+                                                                             : capture_pipeline_kind::plot_point,
+                              surface_format, multisample_count});
+  }
+  return pipeline;
+}
+
+}  // namespace wgpu_utils
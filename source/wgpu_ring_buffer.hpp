@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+// A fixed-capacity ring of elements stored in a GPU storage buffer. Appending only writes the newly added range
+// (split in two where it wraps), so the cost is proportional to the number of new elements rather than the history.
+// Shaders index the buffer with `(first + i) % capacity` to read elements in order.
+class gpu_ring_buffer {
+ public:
+  // `element_size` must be a multiple of 4.
+  gpu_ring_buffer(const wgpu::Device& device, std::uint32_t capacity, std::uint32_t element_size,
+                  std::string_view label);
+
+  // Append elements. If more than `capacity` elements are appended at once, only the newest ones are written.
+  void append(const wgpu::Queue& queue, std::span<const std::byte> elements);
+
+  template <typename T>
+  void append(const wgpu::Queue& queue, const std::span<const T> elements) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    append(queue, std::as_bytes(elements));
+  }
+
+  // Ring index of the oldest of the newest `count` elements (clamped to the number stored).
+  std::uint32_t window_start(std::uint32_t count) const noexcept;
+
+  constexpr const wgpu::Buffer& buffer() const noexcept { return buffer_; }
+  constexpr std::uint32_t capacity() const noexcept { return capacity_; }
+  constexpr std::uint32_t element_size() const noexcept { return element_size_; }
+
+  // Number of valid elements in the ring.
+  constexpr std::uint32_t size() const noexcept {
+    return total_appended_ < capacity_ ? static_cast<std::uint32_t>(total_appended_) : capacity_;
+  }
+
+  // Total number of elements appended over the lifetime of the ring.
+  constexpr std::uint64_t total_appended() const noexcept { return total_appended_; }
+
+ private:
+  wgpu::Buffer buffer_{};
+  std::uint32_t capacity_;
+  std::uint32_t element_size_;
+  // Ring index where the next element will be written.
+  std::uint32_t head_{0};
+  std::uint64_t total_appended_{0};
+};
+
+// A single sample of a plotted time series, in seconds.
+struct plot_sample {
+  double time;
+  float value;
+};
+
+// A sample as stored in the ring, with its time relative to the series origin. Matches `samples` in the shader.
+struct plot_gpu_sample {
+  float time;
+  float value;
+};
+
+// Uniforms for the ring buffer plot pipelines. Matches `PlotUniforms` in the shader.
+struct plot_uniforms {
+  std::uint32_t first;
+  std::uint32_t capacity;
+  float view_min[2];
+  float view_max[2];
+  float padding[2];
+  float color[4];
+};
+static_assert(sizeof(plot_uniforms) == 48);
+
+// Consecutive samples of a `plot_series`, oldest first. `first` is a ring slot.
+struct plot_window {
+  std::uint32_t first{0};
+  std::uint32_t count{0};
+};
+
+// A time series plotted from a `gpu_ring_buffer`. Float32 can't hold absolute times precisely for long: after 1000 s
+// its step is ~61us, coarser than the spacing of a 20kHz stream. So times are kept as double here, and the ring holds
+// float offsets from an origin near the newest sample. Once the newest sample is more than `rebase_interval` from the
+// origin, the origin moves to it and the ring is rewritten from the copy kept here, which costs one upload of the
+// ring every `rebase_interval` seconds.
+class plot_series {
+ public:
+  // Offsets up to this size keep a step of ~8us or finer.
+  static constexpr double rebase_interval = 64.0;
+
+  plot_series(const wgpu::Device& device, std::uint32_t capacity);
+
+  // Append samples, in time order. If more than `capacity` samples are appended at once, only the newest are kept.
+  void append(const wgpu::Queue& queue, std::span<const plot_sample> samples);
+
+  // The samples within `window_seconds` of the newest one, plus the one before them so the line reaches the left
+  // edge. Found by binary search over the time history, so drawing costs follow the window rather than the capacity.
+  plot_window visible(double window_seconds) const noexcept;
+
+  // Uniforms that draw `window` (from `visible`), viewing the `window_seconds` up to the newest sample. Colors are
+  // left zero.
+  plot_uniforms uniforms(const plot_window& window, double window_seconds, float value_min,
+                         float value_max) const noexcept;
+
+  constexpr const gpu_ring_buffer& ring() const noexcept { return ring_; }
+  constexpr std::uint32_t size() const noexcept { return ring_.size(); }
+
+ private:
+  gpu_ring_buffer ring_;
+  // The samples in the ring, in the same slots.
+  std::vector<plot_sample> history_{};
+  std::optional<double> origin_{};
+  double latest_time_{0.0};
+};
+
+// Bind group layout shared by the plot pipelines: (0) the ring of `plot_gpu_sample`, (1) `plot_uniforms`.
+wgpu::BindGroupLayout make_plot_bind_group_layout(const wgpu::Device& device);
+
+// Create a pipeline that draws the samples in a ring buffer as a line strip (`LineStrip`) or as points
+// (`PointList`). Vertex `i` reads sample `(first + i) % capacity`, so the visible window is drawn straight out of
+// the ring with `Draw(count)`.
+wgpu::RenderPipeline make_plot_render_pipeline(const wgpu::Device& device, const wgpu::BindGroupLayout& bg_layout,
+                                               wgpu::TextureFormat surface_format, std::uint32_t multisample_count,
+                                               wgpu::PrimitiveTopology topology);
+
+}  // namespace wgpu_utils
@@ -0,0 +1,203 @@
+#include "wgpu_scene.hpp"
+
+#include <qassert.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "wgpu_capture.hpp"
+#include "wgpu_error_scope.hpp"
+
+namespace wgpu_utils {
+
+std::array<float, 4> axis_angle_rotation(const std::array<float, 3>& axis, const float angle) noexcept {
+  const float s = std::sin(0.5f * angle);
+  return {axis[0] * s, axis[1] * s, axis[2] * s, std::cos(0.5f * angle)};
+}
+
+scene_node scene_graph::add_node(const scene_node parent, const transform& local) {
+  const scene_node node = size();
+  Q_ASSERT(parent == no_parent || parent < node);
+  for (auto& component : translation_) component.push_back(0.0f);
+  for (auto& component : rotation_) component.push_back(0.0f);
+  for (auto& component : scale_) component.push_back(0.0f);
+  parent_.push_back(parent);
+  first_child_.push_back(no_parent);
+  next_sibling_.push_back(no_parent);
+  state_.push_back(node_state::clean);
+  world_.push_back(mat4{});
+  if (parent != no_parent) {
+    next_sibling_[node] = first_child_[parent];
+    first_child_[parent] = node;
+  }
+  set_local_transform(node, local);
+  return node;
+}
+
+void scene_graph::mark_dirty(const scene_node node) {
+  if (state_[node] == node_state::clean) {
+    state_[node] = node_state::dirty;
+    dirty_nodes_.push_back(node);
+  }
+}
+
+void scene_graph::set_local_transform(const scene_node node, const transform& local) {
+  for (std::size_t i = 0; i < 3; ++i) translation_[i][node] = local.translation[i];
+  for (std::size_t i = 0; i < 4; ++i) rotation_[i][node] = local.rotation[i];
+  for (std::size_t i = 0; i < 3; ++i) scale_[i][node] = local.scale[i];
+  mark_dirty(node);
+}
+
+void scene_graph::set_translation(const scene_node node, const std::array<float, 3>& translation) {
+  for (std::size_t i = 0; i < 3; ++i) translation_[i][node] = translation[i];
+  mark_dirty(node);
+}
+
+void scene_graph::set_rotation(const scene_node node, const std::array<float, 4>& rotation) {
+  for (std::size_t i = 0; i < 4; ++i) rotation_[i][node] = rotation[i];
+  mark_dirty(node);
+}
+
+void scene_graph::set_scale(const scene_node node, const std::array<float, 3>& scale) {
+  for (std::size_t i = 0; i < 3; ++i) scale_[i][node] = scale[i];
+  mark_dirty(node);
+}
+
+transform scene_graph::local_transform(const scene_node node) const {
+  transform out{};
+  for (std::size_t i = 0; i < 3; ++i) out.translation[i] = translation_[i][node];
+  for (std::size_t i = 0; i < 4; ++i) out.rotation[i] = rotation_[i][node];
+  for (std::size_t i = 0; i < 3; ++i) out.scale[i] = scale_[i][node];
+  return out;
+}
+
+scene_update scene_graph::update() {
+  if (dirty_nodes_.empty()) {
+    return {};
+  }
+
+  // Collect the subtrees under changed nodes, parents before children. Visiting the changed nodes in index order
+  // means a subtree is always collected from its top-most changed node, and nested changes are skipped.
+  std::sort(dirty_nodes_.begin(), dirty_nodes_.end());
+  update_order_.clear();
+  for (const scene_node root : dirty_nodes_) {
+    if (state_[root] == node_state::collected) {
+      continue;
+    }
+    stack_.push_back(root);
+    while (!stack_.empty()) {
+      const scene_node node = stack_.back();
+      stack_.pop_back();
+      state_[node] = node_state::collected;
+      update_order_.push_back(node);
+      for (scene_node child = first_child_[node]; child != no_parent; child = next_sibling_[child]) {
+        stack_.push_back(child);
+      }
+    }
+  }
+  dirty_nodes_.clear();
+
+  // Local matrices, T * R * S. Inputs and outputs are separate arrays and there are no branches, so the compiler can
+  // vectorize this loop.
+  const std::size_t count = update_order_.size();
+  for (auto& column : local_) {
+    column.resize(count);
+  }
+  const scene_node* const order = update_order_.data();
+  const float* const tx = translation_[0].data();
+  const float* const ty = translation_[1].data();
+  const float* const tz = translation_[2].data();
+  const float* const qx = rotation_[0].data();
+  const float* const qy = rotation_[1].data();
+  const float* const qz = rotation_[2].data();
+  const float* const qw = rotation_[3].data();
+  const float* const sx = scale_[0].data();
+  const float* const sy = scale_[1].data();
+  const float* const sz = scale_[2].data();
+  std::array<float*, 12> l{};
+  for (std::size_t i = 0; i < 12; ++i) {
+    l[i] = local_[i].data();
+  }
+  for (std::size_t k = 0; k < count; ++k) {
+    const scene_node n = order[k];
+    const float x = qx[n], y = qy[n], z = qz[n], w = qw[n];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+    l[0][k] = (1.0f - 2.0f * (yy + zz)) * sx[n];
+    l[1][k] = 2.0f * (xy + wz) * sx[n];
+    l[2][k] = 2.0f * (xz - wy) * sx[n];
+    l[3][k] = 2.0f * (xy - wz) * sy[n];
+    l[4][k] = (1.0f - 2.0f * (xx + zz)) * sy[n];
+    l[5][k] = 2.0f * (yz + wx) * sy[n];
+    l[6][k] = 2.0f * (xz + wy) * sz[n];
+    l[7][k] = 2.0f * (yz - wx) * sz[n];
+    l[8][k] = (1.0f - 2.0f * (xx + yy)) * sz[n];
+    l[9][k] = tx[n];
+    l[10][k] = ty[n];
+    l[11][k] = tz[n];
+  }
+
+  // World matrices, parent * local. Parents come first in `update_order_`, or weren't changed, so they are always up
+  // to date by the time their children are reached. Both matrices are affine, so the bottom row is skipped.
+  static constexpr mat4 identity{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  for (std::size_t k = 0; k < count; ++k) {
+    const scene_node n = order[k];
+    const mat4& p = parent_[n] != no_parent ? world_[parent_[n]] : identity;
+    mat4& out = world_[n];
+    for (std::size_t c = 0; c < 4; ++c) {
+      const float b0 = l[c * 3 + 0][k], b1 = l[c * 3 + 1][k], b2 = l[c * 3 + 2][k];
+      for (std::size_t r = 0; r < 3; ++r) {
+        out[c * 4 + r] = p[r] * b0 + p[4 + r] * b1 + p[8 + r] * b2 + (c == 3 ? p[12 + r] : 0.0f);
+      }
+      out[c * 4 + 3] = c == 3 ? 1.0f : 0.0f;
+    }
+    state_[n] = node_state::clean;
+  }
+
+  // Merge the updated nodes into runs of consecutive indices, so each run is uploaded with one write.
+  sorted_.assign(update_order_.begin(), update_order_.end());
+  std::sort(sorted_.begin(), sorted_.end());
+  scene_update out{};
+  out.updated_nodes = static_cast<std::uint32_t>(count);
+  for (const scene_node n : sorted_) {
+    if (!out.ranges.empty() && out.ranges.back().first + out.ranges.back().count == n) {
+      ++out.ranges.back().count;
+    } else {
+      out.ranges.push_back({n, 1});
+    }
+  }
+  return out;
+}
+
+bool scene_transform_buffer::upload(const wgpu::Device& device, const scene_graph& scene,
+                                    const scene_update& update) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  const std::span<const mat4> matrices = scene.world_matrices();
+  if (matrices.empty()) {
+    return false;
+  }
+
+  // Grow geometrically, so adding nodes one at a time doesn't recreate the buffer (and bind groups) every frame.
+  last_upload_size_ = 0;
+  if (!buffer_ || capacity_ < matrices.size()) {
+    capacity_ = std::max<std::uint32_t>(static_cast<std::uint32_t>(matrices.size()), capacity_ * 2);
+    wgpu::BufferDescriptor descriptor{};
+    descriptor.label = "Scene world matrices";
+    descriptor.size = static_cast<std::uint64_t>(capacity_) * sizeof(mat4);
+    descriptor.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage;
+    buffer_ = create_buffer(device, descriptor);
+    last_upload_size_ = matrices.size_bytes();
+    write_buffer(device.GetQueue(), buffer_, 0, matrices.data(), matrices.size_bytes());
+    return true;
+  }
+  for (const auto& [first, count] : update.ranges) {
+    const std::size_t size = static_cast<std::size_t>(count) * sizeof(mat4);
+    write_buffer(device.GetQueue(), buffer_, static_cast<std::uint64_t>(first) * sizeof(mat4), matrices.data() + first,
+                 size);
+    last_upload_size_ += size;
+  }
+  return false;
+}
+
+}  // namespace wgpu_utils
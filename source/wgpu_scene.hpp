@@ -0,0 +1,120 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <webgpu/webgpu_cpp.h>
+
+namespace wgpu_utils {
+
+// Column-major 4x4 matrix, laid out like WGSL `mat4x4f`.
+using mat4 = std::array<float, 16>;
+static_assert(sizeof(mat4) == 64);
+
+// Translation, rotation (unit quaternion x, y, z, w) and scale, applied as T * R * S.
+struct transform {
+  std::array<float, 3> translation{0.0f, 0.0f, 0.0f};
+  std::array<float, 4> rotation{0.0f, 0.0f, 0.0f, 1.0f};
+  std::array<float, 3> scale{1.0f, 1.0f, 1.0f};
+};
+
+// Rotation of `angle` radians about the (unit) `axis`, as a quaternion.
+std::array<float, 4> axis_angle_rotation(const std::array<float, 3>& axis, float angle) noexcept;
+
+using scene_node = std::uint32_t;
+
+// A run of consecutive nodes.
+struct scene_node_range {
+  scene_node first{0};
+  std::uint32_t count{0};
+};
+
+// Nodes whose world matrices changed in a `scene_graph::update`.
+struct scene_update {
+  // Runs of consecutive updated nodes, in index order. Upload these ranges of `world_matrices()`.
+  std::vector<scene_node_range> ranges{};
+  // Number of nodes recomputed, which is the total length of `ranges`.
+  std::uint32_t updated_nodes{0};
+
+  bool empty() const noexcept { return ranges.empty(); }
+};
+
+// A retained hierarchy of transforms.
+//
+// Local transforms are stored as structure-of-arrays, and nodes are kept in topological order: a node is always
+// added after its parent, so its index is larger. Changing a local transform only flags the node. `update` then
+// recomputes the world matrices of flagged nodes and their descendants, and nothing else, so the per-frame cost
+// follows what changed rather than the size of the scene. Uploads follow the index order: add a subtree's nodes
+// together, so that changing it dirties a few long runs rather than many scattered nodes.
+class scene_graph {
+ public:
+  static constexpr scene_node no_parent = std::numeric_limits<scene_node>::max();
+
+  // Add a node under `parent` (or `no_parent` for a root). Nodes can't be removed.
+  scene_node add_node(scene_node parent, const transform& local = {});
+
+  void set_local_transform(scene_node node, const transform& local);
+  void set_translation(scene_node node, const std::array<float, 3>& translation);
+  void set_rotation(scene_node node, const std::array<float, 4>& rotation);
+  void set_scale(scene_node node, const std::array<float, 3>& scale);
+
+  transform local_transform(scene_node node) const;
+  scene_node parent(const scene_node node) const { return parent_[node]; }
+  std::uint32_t size() const noexcept { return static_cast<std::uint32_t>(parent_.size()); }
+
+  // Recompute world matrices of every node changed since the last update, and their descendants.
+  scene_update update();
+
+  // World matrices, indexed by node. Only valid for nodes that have been through `update`.
+  std::span<const mat4> world_matrices() const noexcept { return world_; }
+
+ private:
+  void mark_dirty(scene_node node);
+
+  // Local transforms, one array per component.
+  std::array<std::vector<float>, 3> translation_{};
+  std::array<std::vector<float>, 4> rotation_{};
+  std::array<std::vector<float>, 3> scale_{};
+
+  // Hierarchy. Children form a singly linked list through `next_sibling_`.
+  std::vector<scene_node> parent_{};
+  std::vector<scene_node> first_child_{};
+  std::vector<scene_node> next_sibling_{};
+
+  // Per-node state, and the nodes whose local transform changed since the last update.
+  enum class node_state : std::uint8_t { clean, dirty, collected };
+  std::vector<node_state> state_{};
+  std::vector<scene_node> dirty_nodes_{};
+
+  std::vector<mat4> world_{};
+
+  // Scratch space reused between updates: nodes to recompute (parents first, then in index order), the traversal
+  // stack, and their local matrices as 12 arrays (the upper 3x4 part, column-major).
+  std::vector<scene_node> update_order_{};
+  std::vector<scene_node> sorted_{};
+  std::vector<scene_node> stack_{};
+  std::array<std::vector<float>, 12> local_{};
+};
+
+// World matrices of a `scene_graph` on the GPU, as `array<mat4x4f>` in a storage buffer.
+class scene_transform_buffer {
+ public:
+  // Upload the ranges of world matrices changed by `update`. The buffer grows as nodes are added, in which case the
+  // whole scene is uploaded and this returns true: bind groups referring to `buffer()` must then be recreated.
+  bool upload(const wgpu::Device& device, const scene_graph& scene, const scene_update& update);
+
+  constexpr const wgpu::Buffer& buffer() const noexcept { return buffer_; }
+  constexpr std::uint32_t capacity() const noexcept { return capacity_; }
+
+  // Bytes written by the last `upload`.
+  constexpr std::uint64_t last_upload_size() const noexcept { return last_upload_size_; }
+
+ private:
+  wgpu::Buffer buffer_{};
+  std::uint32_t capacity_{0};
+  std::uint64_t last_upload_size_{0};
+};
+
+}  // namespace wgpu_utils
@@ -1,18 +1,66 @@
 #include "wgpu_setup.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <span>
 #include <sstream>
+#include <string>
 
 #include "wgpu_fmt.hpp"
 
 namespace wgpu_utils {
 
-wgpu::Adapter request_adapter(const wgpu::Instance& instance) {
+device_profile make_device_profile(const device_profile_kind kind) {
+  device_profile profile{};
+  profile.kind = kind;
+  switch (kind) {
+    case device_profile_kind::debug:
+      profile.power_preference = wgpu::PowerPreference::HighPerformance;
+      profile.optional_features = {wgpu::FeatureName::TimestampQuery};
+      profile.enabled_toggles = {"use_user_defined_labels_in_backend"};
+      break;
+    case device_profile_kind::production:
+      profile.power_preference = wgpu::PowerPreference::HighPerformance;
+      profile.optional_features = {wgpu::FeatureName::TimestampQuery, wgpu::FeatureName::TextureCompressionBC,
+                                   wgpu::FeatureName::TextureCompressionETC2, wgpu::FeatureName::Float32Filterable};
+      profile.request_adapter_limits = true;
+      profile.enabled_toggles = {"skip_validation", "disable_robustness"};
+      break;
+    case device_profile_kind::low_power:
+      profile.power_preference = wgpu::PowerPreference::LowPower;
+      break;
+  }
+  return profile;
+}
+
+std::optional<device_profile_kind> parse_device_profile_kind(const std::string_view name) {
+  std::string normalized{name};
+  std::replace(normalized.begin(), normalized.end(), '-', '_');
+  return magic_enum::enum_cast<device_profile_kind>(normalized);
+}
+
+device_profile_kind default_device_profile_kind() {
+  if (const char* const name = std::getenv("QT_WGPU_PROFILE"); name != nullptr) {
+    if (const auto kind = parse_device_profile_kind(name); kind.has_value()) {
+      return *kind;
+    }
+    fmt::print("Unknown QT_WGPU_PROFILE: {}\n", name);
+  }
+#ifdef NDEBUG
+  return device_profile_kind::production;
+#else
+  return device_profile_kind::debug;
+#endif
+}
+
+wgpu::Adapter request_adapter(const wgpu::Instance& instance, const device_profile& profile) {
   bool request_ended = false;
   wgpu::Adapter adapter_out{};
 
   wgpu::RequestAdapterOptions options{};
-  options.powerPreference = wgpu::PowerPreference::HighPerformance;
+  options.powerPreference = profile.power_preference;
+  options.forceFallbackAdapter = profile.force_fallback_adapter;
+  options.backendType = profile.backend_type;
   instance.RequestAdapter(&options, wgpu::CallbackMode::AllowSpontaneous,
                           [&](wgpu::RequestAdapterStatus status, wgpu::Adapter adapter, wgpu::StringView message) {
                             if (status == wgpu::RequestAdapterStatus::Success) {
@@ -30,10 +78,54 @@ wgpu::Adapter request_adapter(const wgpu::Instance& instance) {
   return adapter_out;
 }
 
-wgpu::Device request_device(const wgpu::Adapter& adapter) {
+wgpu::Device request_device(const wgpu::Adapter& adapter, const device_profile& profile) {
+  fmt::print("Device profile: {}\n", fmt_enum(profile.kind));
+
+  // Only ask for features the adapter actually has.
+  std::vector<wgpu::FeatureName> required_features{};
+  for (const auto feature : profile.optional_features) {
+    if (adapter.HasFeature(feature)) {
+      required_features.push_back(feature);
+    } else {
+      fmt::print(" - feature not supported by adapter: {}\n", fmt_enum(feature));
+    }
+  }
+
+  // Leaving a limit undefined requests the WebGPU default. Otherwise, ask for whatever the adapter can do.
+  wgpu::Limits required_limits{};
+  wgpu::Limits adapter_limits{};
+  if (profile.request_adapter_limits && adapter.GetLimits(&adapter_limits)) {
+    required_limits.maxTextureDimension2D = adapter_limits.maxTextureDimension2D;
+    required_limits.maxBufferSize = adapter_limits.maxBufferSize;
+    required_limits.maxStorageBufferBindingSize = adapter_limits.maxStorageBufferBindingSize;
+    required_limits.maxUniformBufferBindingSize = adapter_limits.maxUniformBufferBindingSize;
+    required_limits.maxStorageBuffersPerShaderStage = adapter_limits.maxStorageBuffersPerShaderStage;
+    required_limits.maxComputeWorkgroupStorageSize = adapter_limits.maxComputeWorkgroupStorageSize;
+  }
+
+  std::vector<const char*> disabled_toggles = profile.disabled_toggles;
+  if (profile.skip_lazy_clear) {
+    disabled_toggles.push_back("lazy_clear_resource_on_first_use");
+  }
+
+  wgpu::DawnTogglesDescriptor toggles{};
+  toggles.enabledToggles = profile.enabled_toggles.data();
+  toggles.enabledToggleCount = profile.enabled_toggles.size();
+  toggles.disabledToggles = disabled_toggles.data();
+  toggles.disabledToggleCount = disabled_toggles.size();
+  for (const char* toggle : profile.enabled_toggles) {
+    fmt::print(" - enable toggle: {}\n", toggle);
+  }
+  for (const char* toggle : disabled_toggles) {
+    fmt::print(" - disable toggle: {}\n", toggle);
+  }
+
   wgpu::DeviceDescriptor device_descriptor{};
+  device_descriptor.nextInChain = &toggles;
   device_descriptor.label = "Default device";
-  device_descriptor.requiredLimits = nullptr;
+  device_descriptor.requiredFeatures = required_features.data();
+  device_descriptor.requiredFeatureCount = required_features.size();
+  device_descriptor.requiredLimits = &required_limits;
   device_descriptor.defaultQueue.label = "Default queue";
   device_descriptor.SetDeviceLostCallback(
       wgpu::CallbackMode::AllowSpontaneous,
@@ -125,6 +217,7 @@ void enumerate_device_limits(const wgpu::Device& device) {
     out << " - maxStorageBuffersPerShaderStage: " << limits.maxStorageBuffersPerShaderStage << std::endl;
     out << " - maxStorageTexturesPerShaderStage: " << limits.maxStorageTexturesPerShaderStage << std::endl;
     out << " - maxUniformBuffersPerShaderStage: " << limits.maxUniformBuffersPerShaderStage << std::endl;
+    out << " - maxBufferSize: " << limits.maxBufferSize << std::endl;
     out << " - maxUniformBufferBindingSize: " << limits.maxUniformBufferBindingSize << std::endl;
     out << " - maxStorageBufferBindingSize: " << limits.maxStorageBufferBindingSize << std::endl;
     out << " - minUniformBufferOffsetAlignment: " << limits.minUniformBufferOffsetAlignment << std::endl;
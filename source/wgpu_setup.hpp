@@ -1,10 +1,57 @@
+#pragma once
+#include <optional>
+#include <string_view>
+#include <vector>
+
 #include <webgpu/webgpu_cpp.h>
 
 namespace wgpu_utils {
 
-wgpu::Adapter request_adapter(const wgpu::Instance& instance);
+// Named device configurations.
+enum class device_profile_kind {
+  // Default limits, full validation and robustness. Catches portability and API usage bugs.
+  debug,
+  // Adapter maximum limits, every useful feature the adapter has, and validation/robustness turned off.
+  production,
+  // Prefer the integrated GPU, default limits, no optional features.
+  low_power,
+};
+
+// Adapter preference, optional features/limits and dawn toggles used when requesting a device.
+struct device_profile {
+  device_profile_kind kind{device_profile_kind::debug};
+  wgpu::PowerPreference power_preference{wgpu::PowerPreference::HighPerformance};
+  // Use the CPU fallback adapter (SwiftShader), for example to replay traces on machines without a GPU.
+  bool force_fallback_adapter{false};
+  // Only consider adapters for this backend. Undefined picks the platform default.
+  wgpu::BackendType backend_type{wgpu::BackendType::Undefined};
+  // Features requested when the adapter supports them. Unsupported ones are logged and skipped.
+  std::vector<wgpu::FeatureName> optional_features{};
+  // Request the adapter's maximum for buffer, binding and texture size limits instead of the WebGPU defaults.
+  bool request_adapter_limits{false};
+  // Dawn toggles, see: https://dawn.googlesource.com/dawn/+/refs/heads/main/src/dawn/native/Toggles.cpp
+  std::vector<const char*> enabled_toggles{};
+  std::vector<const char*> disabled_toggles{};
+  // Skip dawn's zero-fill of textures and buffers before their first use. The caller must then write every byte of
+  // a resource, or clear it with a load op, before anything reads it. Nothing here checks that, and several of our
+  // resources don't meet it: mip levels waiting for `mip_generator`, sub-allocator heaps, and scene buffers after
+  // they grow. No built-in profile sets this.
+  bool skip_lazy_clear{false};
+};
+
+device_profile make_device_profile(device_profile_kind kind);
+
+// Parse a profile name: "debug", "production" or "low-power".
+std::optional<device_profile_kind> parse_device_profile_kind(std::string_view name);
+
+// Profile named by the `QT_WGPU_PROFILE` environment variable. Otherwise `debug` in debug builds, and `production`
+// when NDEBUG is defined.
+device_profile_kind default_device_profile_kind();
+
+wgpu::Adapter request_adapter(const wgpu::Instance& instance, const device_profile& profile);
 
-wgpu::Device request_device(const wgpu::Adapter& adapter);
+// Request a device, negotiating the profile's features and limits against what the adapter supports.
+wgpu::Device request_device(const wgpu::Adapter& adapter, const device_profile& profile);
 
 // Enumerate and print adapter features.
 void enumerate_adapter_features(const wgpu::Adapter& adapter);
@@ -2,10 +2,46 @@
 
 #include <qassert.h>
 
+#include <algorithm>
+#include <bit>
+
+#include "wgpu_capture.hpp"
 #include "wgpu_error_scope.hpp"
+#include "wgpu_mipmaps.hpp"
 
 namespace wgpu_utils {
 
+// Bytes per texel for the uncompressed formats we upload, or zero if unknown.
+std::uint32_t texel_size(const wgpu::TextureFormat format) noexcept {
+  switch (format) {
+    case wgpu::TextureFormat::R8Unorm:
+    case wgpu::TextureFormat::R8Snorm:
+    case wgpu::TextureFormat::R8Uint:
+    case wgpu::TextureFormat::R8Sint:
+      return 1;
+    case wgpu::TextureFormat::RG8Unorm:
+    case wgpu::TextureFormat::RG8Snorm:
+    case wgpu::TextureFormat::R16Float:
+    case wgpu::TextureFormat::R16Uint:
+      return 2;
+    case wgpu::TextureFormat::RGBA8Unorm:
+    case wgpu::TextureFormat::RGBA8UnormSrgb:
+    case wgpu::TextureFormat::BGRA8Unorm:
+    case wgpu::TextureFormat::BGRA8UnormSrgb:
+    case wgpu::TextureFormat::RG16Float:
+    case wgpu::TextureFormat::R32Float:
+    case wgpu::TextureFormat::R32Uint:
+      return 4;
+    case wgpu::TextureFormat::RGBA16Float:
+    case wgpu::TextureFormat::RG32Float:
+      return 8;
+    case wgpu::TextureFormat::RGBA32Float:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
 wgpu::Texture create_multisample_texure(const wgpu::Device& device, const wgpu::TextureFormat texture_format,
                                         std::uint32_t width, std::uint32_t height, std::uint32_t sample_count) {
   WGPU_ERROR_FUNCTION_SCOPE(device);
@@ -18,24 +54,25 @@ wgpu::Texture create_multisample_texure(const wgpu::Device& device, const wgpu::
   return device.CreateTexture(&texture_descriptor);
 }
 
-wgpu::TextureView get_next_surface_texture_view(const wgpu::Device& device, const wgpu::Surface& surface) {
+wgpu::Texture get_next_surface_texture(const wgpu::Device& device, const wgpu::Surface& surface) {
   WGPU_ERROR_FUNCTION_SCOPE(device);
 
-  // Get the surface texture
   wgpu::SurfaceTexture surface_texture;
   surface.GetCurrentTexture(&surface_texture);
   Q_ASSERT(surface_texture.status == wgpu::SurfaceGetCurrentTextureStatus::SuccessOptimal ||
            surface_texture.status == wgpu::SurfaceGetCurrentTextureStatus::SuccessSuboptimal);
+  return surface_texture.texture;
+}
 
-  // Create a view for this surface texture
+wgpu::TextureView create_surface_texture_view(const wgpu::Texture& texture) {
   wgpu::TextureViewDescriptor view_descriptor{};
   view_descriptor.label = "Surface texture view";
-  view_descriptor.format = surface_texture.texture.GetFormat();
+  view_descriptor.format = texture.GetFormat();
   view_descriptor.dimension = wgpu::TextureViewDimension::e2D;
   view_descriptor.baseMipLevel = 0;
   view_descriptor.mipLevelCount = 1;
   view_descriptor.aspect = wgpu::TextureAspect::All;
-  return surface_texture.texture.CreateView(&view_descriptor);
+  return texture.CreateView(&view_descriptor);
 }
 
 wgpu::Texture create_depth_texture(const wgpu::Device& device, std::uint32_t width, std::uint32_t height,
@@ -53,4 +90,54 @@ wgpu::Texture create_depth_texture(const wgpu::Device& device, std::uint32_t wid
   return device.CreateTexture(&texture_descriptor);
 }
 
+std::uint32_t mip_level_count(const std::uint32_t width, const std::uint32_t height) noexcept {
+  return static_cast<std::uint32_t>(std::bit_width(std::max({width, height, 1u})));
+}
+
+wgpu::Sampler create_trilinear_sampler(const wgpu::Device& device) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+
+  wgpu::SamplerDescriptor descriptor{};
+  descriptor.label = "Trilinear sampler";
+  descriptor.addressModeU = wgpu::AddressMode::Repeat;
+  descriptor.addressModeV = wgpu::AddressMode::Repeat;
+  descriptor.addressModeW = wgpu::AddressMode::Repeat;
+  descriptor.magFilter = wgpu::FilterMode::Linear;
+  descriptor.minFilter = wgpu::FilterMode::Linear;
+  descriptor.mipmapFilter = wgpu::MipmapFilterMode::Linear;
+  return device.CreateSampler(&descriptor);
+}
+
+wgpu::Texture create_texture_2d(const wgpu::Device& device, const wgpu::TextureFormat format,
+                                const std::uint32_t width, const std::uint32_t height,
+                                const std::span<const std::byte> data, const bool with_mips,
+                                const std::string_view label) {
+  WGPU_ERROR_FUNCTION_SCOPE(device);
+  const std::uint32_t row_size = width * texel_size(format);
+  Q_ASSERT(row_size > 0);
+  Q_ASSERT(data.size() == static_cast<std::size_t>(row_size) * height);
+
+  wgpu::TextureDescriptor texture_descriptor{};
+  texture_descriptor.label = label;
+  texture_descriptor.size = wgpu::Extent3D{width, height, 1};
+  texture_descriptor.format = format;
+  texture_descriptor.dimension = wgpu::TextureDimension::e2D;
+  texture_descriptor.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+  if (with_mips) {
+    Q_ASSERT(mip_generator::supports(format));
+    texture_descriptor.mipLevelCount = mip_level_count(width, height);
+    texture_descriptor.usage |= mip_generator::required_usage;
+  }
+  const wgpu::Texture texture = create_texture(device, texture_descriptor);
+
+  wgpu::TexelCopyTextureInfo destination{};
+  destination.texture = texture;
+  wgpu::TexelCopyBufferLayout layout{};
+  layout.bytesPerRow = row_size;
+  layout.rowsPerImage = height;
+  const wgpu::Extent3D extent{width, height, 1};
+  write_texture(device.GetQueue(), destination, data.data(), data.size(), layout, extent);
+  return texture;
+}
+
 }  // namespace wgpu_utils
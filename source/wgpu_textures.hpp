@@ -1,14 +1,36 @@
 #pragma once
+#include <cstdint>
+#include <span>
+#include <string_view>
+
 #include <webgpu/webgpu_cpp.h>
 
 namespace wgpu_utils {
 
+// Bytes per texel for the uncompressed formats we upload, or zero if unknown.
+std::uint32_t texel_size(wgpu::TextureFormat format) noexcept;
+
+// Number of levels in a full mip chain, down to 1x1.
+std::uint32_t mip_level_count(std::uint32_t width, std::uint32_t height) noexcept;
+
+// Sampler that repeats, and filters linearly between texels and between mip levels.
+wgpu::Sampler create_trilinear_sampler(const wgpu::Device& device);
+
+// Create a sampled 2D texture and upload `data` (tightly packed rows) to level 0. With `with_mips` the texture gets a
+// full mip chain, plus the usages `mip_generator` needs to fill it: the remaining levels are undefined until then.
+wgpu::Texture create_texture_2d(const wgpu::Device& device, wgpu::TextureFormat format, std::uint32_t width,
+                                std::uint32_t height, std::span<const std::byte> data, bool with_mips,
+                                std::string_view label);
+
 // Create texture suitable for MSAA render attachment.
 wgpu::Texture create_multisample_texure(const wgpu::Device& device, const wgpu::TextureFormat texture_format,
                                         std::uint32_t width, std::uint32_t height, std::uint32_t multisample_count);
 
-// Get the next texture view in the swap chain for our target surface.
-wgpu::TextureView get_next_surface_texture_view(const wgpu::Device& device, const wgpu::Surface& surface);
+// Get the next texture in the swap chain for our target surface.
+wgpu::Texture get_next_surface_texture(const wgpu::Device& device, const wgpu::Surface& surface);
+
+// Create a view of a texture returned by `get_next_surface_texture`, to render into.
+wgpu::TextureView create_surface_texture_view(const wgpu::Texture& texture);
 
 // Create a 32-bit texture suitable for a depth buffer.
 wgpu::Texture create_depth_texture(const wgpu::Device& device, std::uint32_t width, std::uint32_t height,